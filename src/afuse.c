@@ -20,6 +20,7 @@
 
 #include <fuse.h>
 #include <fuse_opt.h>
+#include <fuse_lowlevel.h>
 #ifndef __USE_BSD
 // for mkdtemp
 #define __USE_BSD
@@ -29,7 +30,6 @@
 #include <string.h>
 #include <stddef.h>
 #include <unistd.h>
-#include <alloca.h>
 #include <fcntl.h>
 #include <dirent.h>
 #include <errno.h>
@@ -39,6 +39,7 @@
 #include <unistd.h>
 #include <stdint.h>
 #include <signal.h>
+#include <pthread.h>
 #include <fnmatch.h>
 #ifdef HAVE_SETXATTR
 #include <sys/xattr.h>
@@ -59,17 +60,33 @@
 #endif				/* XATTR_NOFOLLOW */
 #endif				/* HAVE_SETXATTR */
 
-#include "fd_list.h"
-#include "dir_list.h"
-#include "string_sorted_list.h"
+#include "handle_set.h"
+#include "mount_filter.h"
+#include "string_set.h"
 #include "utils.h"
-
-#include "variable_pairing_heap.h"
+#include "event_loop.h"
+#include "attr_cache.h"
+#include "flusher.h"
+#include "notifier.h"
+#include "mount_backoff.h"
+#include "root_listing.h"
+
+#include "timer_wheel.h"
+
+// Flags the root of every mount is opened with, see mount_root_t
+#ifdef O_PATH
+#define O_ROOT_FLAGS (O_PATH | O_DIRECTORY | O_CLOEXEC)
+#else
+#define O_ROOT_FLAGS (O_RDONLY | O_DIRECTORY | O_CLOEXEC)
+#endif
 
 #define TMP_DIR_TEMPLATE "/tmp/afuse-XXXXXX"
 #define TMP_DIR_TEMPLATE2 "/afuse-XXXXXX"
 static char *mount_point_directory;
+static size_t mount_point_directory_len;
 static dev_t mount_point_dev;
+// /proc/self/mountinfo, watched for mounts dying, or -1 if it can't be
+static int mountinfo_fd = -1;
 
 // Data structure filled in when parsing command line args
 struct user_options_t {
@@ -79,80 +96,124 @@ struct user_options_t {
 	char *filter_file;
 	bool flush_writes;
 	bool exact_getattr;
+	bool symlink_mounts;
+	bool prefetch_attrs;
 	uint64_t auto_unmount_delay;
 	char *mount_dir;
+	unsigned int threads;
+	unsigned int flush_interval;
+	uint64_t flush_bytes;
+	bool attr_cache;
+	unsigned int attr_cache_size;
+	unsigned int attr_cache_ttl;
+	unsigned int mount_backoff;
+	unsigned int mount_backoff_max;
+	unsigned int populate_root_ttl;
 } user_options = {
-	NULL, NULL, NULL, NULL, false, false, UINT64_MAX, NULL
+	NULL, NULL, NULL, NULL, false, false, false, false, UINT64_MAX, NULL, 10,
+	100, 8 << 20, false, 65536, 1000, 0, 300, 0
 };
 
+typedef enum {
+	MOUNT_STATE_MOUNTING,	// mount command running
+	MOUNT_STATE_MOUNTED,
+	MOUNT_STATE_UNMOUNTING,	// unmount command running
+	MOUNT_STATE_DEAD	// failed to mount or unmounted, no longer listed
+} mount_state_t;
+
+// Descriptor of the root of a mounted filesystem, which operations resolve
+// their paths relative to with the *at() system calls rather than walking
+// mount_point_directory again. It keeps the filesystem busy, so it is
+// released once unmounting starts; operations still using it hold a
+// reference. Guarded by mount_list_lock.
+typedef struct _mount_root_t {
+	int fd;
+	int refcount;
+} mount_root_t;
+
 typedef struct _mount_list_t {
 	struct _mount_list_t *next;
 	struct _mount_list_t *prev;
 
+	/* Chains the mounts whose root_name hashes to the same mount_table
+	   bucket. */
+	struct _mount_list_t *hash_next;
+	uint32_t hash;
+
 	char *root_name;
 	char *mount_point;
-	fd_list_t *fd_list;
-	dir_list_t *dir_list;
-
-	 PH_NEW_LINK(struct _mount_list_t) auto_unmount_ph_node;
-	/* This is the sort key for the auto_unmount_ph heap.  It will
-	   equal UINT64_MAX if this node is not in the heap. */
-	int64_t auto_unmount_time;
+	uint64_t id;		/* Unique for the lifetime of afuse */
+	bool keep_cache;	/* Matches a -o keep_cache glob */
+
+	/* Guards handles and attr_generation. */
+	pthread_mutex_t lock;
+	handle_set_t handles;
+	/* Bumped whenever an operation may have changed attributes in the
+	   mount, invalidating what attr_cache holds for it. */
+	uint64_t attr_generation;
+
+	/* The following are guarded by mount_list_lock.  The mount list
+	   holds one reference while the mount is linked into it, every
+	   in-flight operation holds another.  state_cond is broadcast on
+	   every state change. */
+	int refcount;
+	mount_state_t state;
+	pthread_cond_t state_cond;
+	mount_root_t *root;	/* NULL unless mounted */
+	dev_t dev;		/* Of the mounted filesystem, once mounted */
+
+	/* Scheduled in auto_unmount_wheel while the mount is idle.  Using
+	   the mount only updates last_used, the timer is pushed back once
+	   it expires. */
+	timer_node_t auto_unmount_node;
+	int64_t last_used;	/* In AUTO_UNMOUNT_TICKs */
 } mount_list_t;
 
-typedef struct _mount_filter_list_t {
-	struct _mount_filter_list_t *next;
-
-	char *pattern;
-} mount_filter_list_t;
-
-PH_DECLARE_TYPE(auto_unmount_ph, mount_list_t)
-    PH_DEFINE_TYPE(auto_unmount_ph, mount_list_t, auto_unmount_ph_node,
-	       auto_unmount_time)
-static mount_filter_list_t *mount_filter_list = NULL;
-
-#define BLOCK_SIGALRM \
-	sigset_t block_sigalrm_oldset, block_sigalrm_set;	\
-	sigemptyset(&block_sigalrm_set); \
-	sigaddset(&block_sigalrm_set, SIGALRM); \
-	sigprocmask(SIG_BLOCK, &block_sigalrm_set, &block_sigalrm_oldset)
-
-#define UNBLOCK_SIGALRM \
-	sigprocmask(SIG_SETMASK, &block_sigalrm_oldset, NULL)
-
 #define DEFAULT_CASE_INVALID_ENUM  \
 		fprintf(stderr, "Unexpected switch value in %s:%s:%d\n", \
 			__FILE__, __func__, __LINE__);  \
 		exit(1);
 
-static auto_unmount_ph_t auto_unmount_ph;
-static int64_t auto_unmount_next_timeout = INT64_MAX;
-
-static void add_mount_filter(const char *glob)
-{
-	mount_filter_list_t *new_entry;
+// Granularity of the auto unmount timeout, in microseconds
+#define AUTO_UNMOUNT_TICK 1000000
 
-	new_entry = my_malloc(sizeof(mount_filter_list_t));
-	new_entry->pattern = my_strdup(glob);
-	new_entry->next = mount_filter_list;
+static timer_wheel_t auto_unmount_wheel;
+static int64_t auto_unmount_delay_ticks;
+static int64_t auto_unmount_next_timeout = INT64_MAX;	/* In ticks */
 
-	mount_filter_list = new_entry;
-}
+// Guards mount_list, the auto_unmount_wheel and the refcount/state
+// fields of every mount. It is never held while running a (un)mount command
+// or while accessing a proxied filesystem, so it only serialises the
+// bookkeeping; the I/O itself runs concurrently on all mounts.
+static pthread_mutex_t mount_list_lock = PTHREAD_MUTEX_INITIALIZER;
 
-static int is_mount_filtered(const char *mount_point)
-{
-	mount_filter_list_t *current_filter;
+// Assigns mount_list_t::id, guarded by mount_list_lock
+static uint64_t next_mount_id = 0;
 
-	current_filter = mount_filter_list;
+// Globs given with -o keep_cache, the roots whose files keep their page
+// cache when opened
+static char **keep_cache_globs = NULL;
+static size_t keep_cache_glob_count = 0;
 
-	while (current_filter) {
-		if (!fnmatch(current_filter->pattern, mount_point, 0))
-			return 1;
+static void add_keep_cache_glob(const char *glob)
+{
+	// Grow by doubling
+	if (!(keep_cache_glob_count & (keep_cache_glob_count - 1)))
+		keep_cache_globs = my_realloc(keep_cache_globs,
+					      (keep_cache_glob_count ?
+					       2 * keep_cache_glob_count : 1) *
+					      sizeof(*keep_cache_globs));
+	keep_cache_globs[keep_cache_glob_count++] = my_strdup(glob);
+}
 
-		current_filter = current_filter->next;
-	}
+static bool keep_cache_match(const char *root_name)
+{
+	size_t i;
 
-	return 0;
+	for (i = 0; i < keep_cache_glob_count; i++)
+		if (!fnmatch(keep_cache_globs[i], root_name, 0))
+			return true;
+	return false;
 }
 
 static void load_mount_filter_file(const char *filename)
@@ -183,23 +244,14 @@ static void load_mount_filter_file(const char *filename)
 		}
 
 		if (llen > 0)
-			add_mount_filter(line);
+			mount_filter_add(line);
 	}
 
 	free(line);
 
 	fclose(filter_file);
-}
-
-static int64_t from_timeval(const struct timeval *tv)
-{
-	return (int64_t) tv->tv_sec * 1000000 + ((int64_t) tv->tv_usec);
-}
 
-static void to_timeval(struct timeval *tv, int64_t usec)
-{
-	tv->tv_sec = usec / 1000000;
-	tv->tv_usec = usec % 1000000;
+	mount_filter_compile();
 }
 
 static int get_retval(int res)
@@ -209,96 +261,211 @@ static int get_retval(int res)
 	return 0;
 }
 
+// Returns 0 if the filesystem is no longer mounted. Free when mountinfo
+// is watched, mountinfo_changed() then reaps dead mounts in the background.
 static int check_mount(mount_list_t * mount)
 {
 	struct stat buf;
 
+	if (mountinfo_fd != -1)
+		return 1;
 	if (lstat(mount->mount_point, &buf) == -1)
 		return 0;
-	if (buf.st_dev == mount_point_dev)
-		return 0;
-	return 1;
+	return buf.st_dev == mount->dev;
 }
 
-static void update_auto_unmount(mount_list_t * mount)
+static uint64_t attr_generation(mount_list_t * mount)
 {
-	if (user_options.auto_unmount_delay == UINT64_MAX)
+	uint64_t generation;
+
+	pthread_mutex_lock(&mount->lock);
+	generation = mount->attr_generation;
+	pthread_mutex_unlock(&mount->lock);
+
+	return generation;
+}
+
+// Must be called after anything that may have changed attributes
+// anywhere in the mount.
+static void invalidate_attrs(mount_list_t * mount)
+{
+	if (!user_options.attr_cache || !mount)
 		return;
 
-	/* Get the current time */
-	struct timeval tv;
-	mount_list_t *min_mount;
-	int64_t cur_time, next_time;
-	gettimeofday(&tv, NULL);
-	cur_time = from_timeval(&tv);
+	pthread_mutex_lock(&mount->lock);
+	mount->attr_generation++;
+	pthread_mutex_unlock(&mount->lock);
+}
 
-	if (mount) {
-		/* Always remove first */
-		if (mount->auto_unmount_time != INT64_MAX)
-			auto_unmount_ph_remove(&auto_unmount_ph, mount);
-
-		if (!mount->fd_list && !mount->dir_list) {
-			mount->auto_unmount_time =
-			    cur_time + user_options.auto_unmount_delay;
-			auto_unmount_ph_insert(&auto_unmount_ph, mount);
-		} else {
-			mount->auto_unmount_time = INT64_MAX;
-		}
+// Must be called after anything that may have changed the attributes of
+// path alone.
+static void invalidate_path(mount_list_t * mount, const char *path)
+{
+	if (!user_options.attr_cache || !mount || !path)
+		return;
+
+	attr_cache_invalidate(str_hash(path));
+}
+
+// Must be called after adding or removing the name path, which changes
+// the directory it is in too.
+static void invalidate_entry(mount_list_t * mount, const char *path)
+{
+	uint32_t hash = STR_HASH_INIT, dir_hash = hash;
+	size_t i;
+
+	if (!user_options.attr_cache || !mount)
+		return;
+
+	for (i = 0; path[i]; i++) {
+		if (path[i] == '/')
+			dir_hash = hash;
+		hash = STR_HASH_STEP(hash, path[i]);
 	}
-	min_mount = auto_unmount_ph_min(&auto_unmount_ph);
-	next_time = min_mount ? min_mount->auto_unmount_time : INT64_MAX;
+	attr_cache_invalidate(hash);
+	attr_cache_invalidate(dir_hash);
+}
 
-	if (next_time != auto_unmount_next_timeout) {
-		struct itimerval itv;
-		auto_unmount_next_timeout = next_time;
+static bool mount_has_handles(mount_list_t * mount)
+{
+	bool has_handles;
 
-		if (next_time != INT64_MAX) {
-			if (next_time > cur_time)
-				to_timeval(&itv.it_value, next_time - cur_time);
-			else	/* Timer is set to expire immediately --- set it to 1 instead */
-				to_timeval(&itv.it_value, 1);
-		} else {
-			/* Disable the timer */
-			to_timeval(&itv.it_value, 0);
-		}
-		to_timeval(&itv.it_interval, 0);
-		if (setitimer(ITIMER_REAL, &itv, NULL) != 0) {
-			perror("Error setting timer");
-		}
+	pthread_mutex_lock(&mount->lock);
+	has_handles = !handle_set_empty(&mount->handles);
+	pthread_mutex_unlock(&mount->lock);
+
+	return has_handles;
+}
+
+static void arm_auto_unmount_timer(int64_t tick)
+{
+	auto_unmount_next_timeout = tick;
+	event_loop_arm_timer(tick == INT64_MAX ? INT64_MAX :
+			     tick * AUTO_UNMOUNT_TICK);
+}
+
+// Records a use of the mount and (un)schedules its auto unmount as
+// needed. Must be called with mount_list_lock held.
+static void update_auto_unmount(mount_list_t * mount)
+{
+	int64_t now, due;
+
+	if (user_options.auto_unmount_delay == UINT64_MAX)
+		return;
+
+	now = event_loop_now() / AUTO_UNMOUNT_TICK;
+	mount->last_used = now;
+
+	if (mount->state != MOUNT_STATE_MOUNTED || mount_has_handles(mount)) {
+		if (timer_node_scheduled(&mount->auto_unmount_node))
+			timer_wheel_remove(&auto_unmount_wheel,
+					   &mount->auto_unmount_node);
+	} else if (!timer_node_scheduled(&mount->auto_unmount_node)) {
+		/* Rounded up, the current tick is partly over */
+		due = timer_wheel_add(&auto_unmount_wheel,
+				      &mount->auto_unmount_node,
+				      now + auto_unmount_delay_ticks + 1, now);
+		if (due < auto_unmount_next_timeout)
+			arm_auto_unmount_timer(due);
 	}
 }
 
 int do_umount(mount_list_t * mount);
+void put_mount(mount_list_t * mount);
 
-static void handle_auto_unmount_timer(int x)
+// Timer handler, run on the event thread. Expires the idle mounts in
+// batches, at most once per tick.
+static void handle_auto_unmount_timer(void *arg)
 {
-	(void)x;		/* Ignored */
-	/* Get the current time */
-	struct timeval tv;
-	int64_t cur_time;
+	int64_t now = event_loop_now() / AUTO_UNMOUNT_TICK, expires;
+	timer_node_t *node;
 	mount_list_t *mount;
-	gettimeofday(&tv, NULL);
-	cur_time = from_timeval(&tv);
 
-	while ((mount = auto_unmount_ph_min(&auto_unmount_ph)) != NULL &&
-	       mount->auto_unmount_time <= cur_time) {
+	(void)arg;
+	pthread_mutex_lock(&mount_list_lock);
+	while ((node = timer_wheel_expire(&auto_unmount_wheel, now))) {
+		mount = TIMER_WHEEL_ENTRY(node, mount_list_t,
+					  auto_unmount_node);
+
+		/* Used since it was scheduled, push it back */
+		expires = mount->last_used + auto_unmount_delay_ticks + 1;
+		if (expires > now) {
+			timer_wheel_add(&auto_unmount_wheel, node, expires,
+					now);
+			continue;
+		}
+
+		/* Operations still in flight reschedule it once they
+		   drop their reference. */
+		if (mount->refcount > 1)
+			continue;
+
+		mount->refcount++;
+		pthread_mutex_unlock(&mount_list_lock);
 		do_umount(mount);
+		put_mount(mount);
+		pthread_mutex_lock(&mount_list_lock);
 	}
 
-	update_auto_unmount(NULL);
+	arm_auto_unmount_timer(timer_wheel_next(&auto_unmount_wheel));
+	pthread_mutex_unlock(&mount_list_lock);
 }
 
+// Root name of a path, pointing into the path rather than copied out of it
+typedef struct _root_name_t {
+	const char *name;	/* Not NUL terminated */
+	size_t len;
+	uint32_t hash;		/* str_hash() of the name */
+} root_name_t;
+
+// Every mount is both on mount_list, for ordered iteration, and in the
+// mount_table hash index, for lookups by root name. Both are guarded by
+// mount_list_lock.
 mount_list_t *mount_list = NULL;
 
-mount_list_t *find_mount(const char *root_name)
+#define MOUNT_TABLE_MIN_SIZE 64
+
+static mount_list_t **mount_table = NULL;
+static size_t mount_table_size = 0;	/* Always a power of two */
+static size_t mount_count = 0;
+
+// Must be called with mount_list_lock held.
+static void mount_table_resize(size_t size)
 {
-	mount_list_t *current_mount = mount_list;
+	mount_list_t **table, *mount, *next;
+	size_t i;
+
+	table = my_malloc(size * sizeof(*table));
+	memset(table, 0, size * sizeof(*table));
+	for (i = 0; i < mount_table_size; i++)
+		for (mount = mount_table[i]; mount; mount = next) {
+			next = mount->hash_next;
+			mount->hash_next = table[mount->hash & (size - 1)];
+			table[mount->hash & (size - 1)] = mount;
+		}
+
+	free(mount_table);
+	mount_table = table;
+	mount_table_size = size;
+}
+
+// Must be called with mount_list_lock held.
+mount_list_t *find_mount(const root_name_t * root_name)
+{
+	mount_list_t *current_mount;
 
+	if (!mount_table_size)
+		return NULL;
+
+	current_mount = mount_table[root_name->hash & (mount_table_size - 1)];
 	while (current_mount) {
-		if (strcmp(root_name, current_mount->root_name) == 0)
+		if (current_mount->hash == root_name->hash &&
+		    strncmp(root_name->name, current_mount->root_name,
+			    root_name->len) == 0 &&
+		    current_mount->root_name[root_name->len] == '\0')
 			return current_mount;
 
-		current_mount = current_mount->next;
+		current_mount = current_mount->hash_next;
 	}
 
 	return NULL;
@@ -306,47 +473,233 @@ mount_list_t *find_mount(const char *root_name)
 
 int is_mount(const char *root_name)
 {
-	return find_mount(root_name) ? 1 : 0;
+	root_name_t name = { root_name, strlen(root_name), str_hash(root_name) };
+	mount_list_t *mount;
+	int ret;
+
+	pthread_mutex_lock(&mount_list_lock);
+	mount = find_mount(&name);
+	ret = (mount && mount->state == MOUNT_STATE_MOUNTED) ? 1 : 0;
+	pthread_mutex_unlock(&mount_list_lock);
+
+	return ret;
+}
+
+// Returns the mounted filesystem for root_name with a reference held, or
+// NULL. Never waits for nor starts a mount, see do_mount() for that.
+// The reference must be dropped with put_mount().
+mount_list_t *get_mount(const root_name_t * root_name)
+{
+	mount_list_t *mount;
+
+	pthread_mutex_lock(&mount_list_lock);
+	if ((mount = find_mount(root_name)) &&
+	    mount->state == MOUNT_STATE_MOUNTED)
+		mount->refcount++;
+	else
+		mount = NULL;
+	pthread_mutex_unlock(&mount_list_lock);
+
+	return mount;
+}
+
+// Must be called with mount_list_lock held.
+static void unref_mount(mount_list_t * mount)
+{
+	if (--mount->refcount == 0) {
+		pthread_cond_destroy(&mount->state_cond);
+		pthread_mutex_destroy(&mount->lock);
+		handle_set_destroy(&mount->handles);
+		free(mount->root_name);
+		free(mount->mount_point);
+		free(mount);
+	}
+}
+
+// Drops a reference taken by get_mount()/do_mount(), re-arming the
+// auto unmount timer for the mount as the original code did after each
+// operation.
+void put_mount(mount_list_t * mount)
+{
+	pthread_mutex_lock(&mount_list_lock);
+	update_auto_unmount(mount);
+	unref_mount(mount);
+	pthread_mutex_unlock(&mount_list_lock);
+}
+
+// Must be called with mount_list_lock held. Returns true if the caller
+// must now close root->fd and free root.
+static bool unref_root(mount_root_t * root)
+{
+	return root && --root->refcount == 0;
+}
+
+static void put_root(mount_root_t * root)
+{
+	bool last;
+
+	pthread_mutex_lock(&mount_list_lock);
+	last = unref_root(root);
+	pthread_mutex_unlock(&mount_list_lock);
+
+	if (last) {
+		close(root->fd);
+		free(root);
+	}
+}
+
+// Allocates the handle of an open file (dir == NULL) or directory and
+// registers it with mount, if not NULL, which stays referenced until the
+// handle is freed.
+static handle_t *new_handle(mount_list_t * mount, int fd,
+			    dir_stream_t * dir)
+{
+	handle_t *handle = my_malloc(sizeof(handle_t));
+
+	handle->fd = fd;
+	handle->dir = dir;
+	handle->mount = mount;
+	handle->sync_io = false;
+	handle->dirty = false;
+	handle->syncing = false;
+	handle->flush_error = 0;
+	if (mount) {
+		pthread_mutex_lock(&mount_list_lock);
+		mount->refcount++;
+		pthread_mutex_unlock(&mount_list_lock);
+
+		pthread_mutex_lock(&mount->lock);
+		handle_set_add(&mount->handles, handle);
+		pthread_mutex_unlock(&mount->lock);
+	}
+
+	return handle;
+}
+
+// Closes the handle and frees it. Returns the result of the close.
+static int free_handle(handle_t * handle)
+{
+	mount_list_t *mount = handle->mount;
+	int res;
+
+	// Errors are lost here, afuse_flush() reports them on close()
+	if (user_options.flush_writes && !handle->dir)
+		flusher_flush(handle);
+
+	if (mount) {
+		pthread_mutex_lock(&mount->lock);
+		handle_set_remove(&mount->handles, handle);
+		pthread_mutex_unlock(&mount->lock);
+	}
+
+	res = handle->dir ? dir_stream_close(handle->dir) : close(handle->fd);
+	if (mount)
+		put_mount(mount);
+	free(handle);
+
+	return res;
+}
+
+// Returns an array of every mounted filesystem, each with a reference
+// held. Used to walk the mounts without holding mount_list_lock across
+// the walk.
+mount_list_t **get_all_mounts(size_t *count)
+{
+	mount_list_t *mount, **mounts;
+	size_t n = 0;
+
+	pthread_mutex_lock(&mount_list_lock);
+	for (mount = mount_list; mount; mount = mount->next)
+		n++;
+	mounts = my_malloc((n + 1) * sizeof(*mounts));
+	n = 0;
+	for (mount = mount_list; mount; mount = mount->next) {
+		if (mount->state != MOUNT_STATE_MOUNTED)
+			continue;
+		mount->refcount++;
+		mounts[n++] = mount;
+	}
+	pthread_mutex_unlock(&mount_list_lock);
+
+	*count = n;
+	return mounts;
 }
 
-mount_list_t *add_mount(const char *root_name, char *mount_point)
+// Links a new mount in the MOUNT_STATE_MOUNTING state, so concurrent
+// accesses to the same root find it and wait for the outcome. Returns it
+// with a reference held for the caller. Must be called with
+// mount_list_lock held.
+static mount_list_t *add_mount(const root_name_t * root_name)
 {
-	mount_list_t *new_mount;
+	mount_list_t *new_mount, **bucket;
 
 	new_mount = (mount_list_t *) my_malloc(sizeof(mount_list_t));
-	new_mount->root_name = my_strdup(root_name);
-	new_mount->mount_point = mount_point;
+	new_mount->hash = root_name->hash;
+	new_mount->root_name = my_malloc(root_name->len + 1);
+	memcpy(new_mount->root_name, root_name->name, root_name->len);
+	new_mount->root_name[root_name->len] = '\0';
+	new_mount->mount_point = NULL;
+	new_mount->id = next_mount_id++;
+	new_mount->keep_cache = keep_cache_match(new_mount->root_name);
+
+	pthread_mutex_init(&new_mount->lock, NULL);
+	handle_set_init(&new_mount->handles);
+	new_mount->attr_generation = 0;
+	new_mount->refcount = 2;
+	new_mount->state = MOUNT_STATE_MOUNTING;
+	pthread_cond_init(&new_mount->state_cond, NULL);
+	new_mount->root = NULL;
+	new_mount->dev = 0;
+	timer_node_init(&new_mount->auto_unmount_node);
+	new_mount->last_used = 0;
 
 	new_mount->next = mount_list;
 	new_mount->prev = NULL;
-	new_mount->fd_list = NULL;
-	new_mount->dir_list = NULL;
-	new_mount->auto_unmount_time = INT64_MAX;
 	if (mount_list)
 		mount_list->prev = new_mount;
 
 	mount_list = new_mount;
 
-	update_auto_unmount(new_mount);
+	/* Keep the load factor at most 1 */
+	if (++mount_count > mount_table_size)
+		mount_table_resize(mount_table_size ? mount_table_size * 2 :
+				   MOUNT_TABLE_MIN_SIZE);
+	bucket = &mount_table[new_mount->hash & (mount_table_size - 1)];
+	new_mount->hash_next = *bucket;
+	*bucket = new_mount;
 
 	return new_mount;
 }
 
-void remove_mount(mount_list_t * current_mount)
+// Unlinks the mount so it can no longer be found, marks it dead and wakes
+// up anyone waiting on it. The memory is released once the last reference
+// is dropped. Must be called with mount_list_lock held.
+static void remove_mount(mount_list_t * current_mount)
 {
-	if (current_mount->auto_unmount_time != INT64_MAX)
-		auto_unmount_ph_remove(&auto_unmount_ph, current_mount);
+	mount_list_t **bucket;
+
+	if (timer_node_scheduled(&current_mount->auto_unmount_node))
+		timer_wheel_remove(&auto_unmount_wheel,
+				   &current_mount->auto_unmount_node);
 
-	free(current_mount->root_name);
-	free(current_mount->mount_point);
 	if (current_mount->prev)
 		current_mount->prev->next = current_mount->next;
 	else
 		mount_list = current_mount->next;
 	if (current_mount->next)
 		current_mount->next->prev = current_mount->prev;
-	free(current_mount);
-	update_auto_unmount(NULL);
+
+	bucket = &mount_table[current_mount->hash & (mount_table_size - 1)];
+	while (*bucket != current_mount)
+		bucket = &(*bucket)->hash_next;
+	*bucket = current_mount->hash_next;
+	mount_count--;
+
+	current_mount->state = MOUNT_STATE_DEAD;
+	pthread_cond_broadcast(&current_mount->state_cond);
+
+	/* Drop the reference held by the mount list */
+	unref_mount(current_mount);
 }
 
 char *make_mount_point(const char *root_name)
@@ -355,7 +708,7 @@ char *make_mount_point(const char *root_name)
 
 	// Create the mount point
 	dir_tmp =
-	    my_malloc(strlen(mount_point_directory) + 2 + strlen(root_name));
+	    my_malloc(mount_point_directory_len + 2 + strlen(root_name));
 	strcpy(dir_tmp, mount_point_directory);
 	strcat(dir_tmp, "/");
 	strcat(dir_tmp, root_name);
@@ -369,9 +722,37 @@ char *make_mount_point(const char *root_name)
 	return dir_tmp;
 }
 
+// Called from the event thread once a command started by spawn_template()
+// has exited, success being true if it exited with status 0.
+typedef void (*command_done_t) (void *arg, bool success);
+
+typedef struct _command_t {
+	char *command;
+	command_done_t done;
+	void *arg;
+} command_t;
+
+static void command_exited(void *arg, int status)
+{
+	command_t *command = arg;
+	bool success = status != -1 && WIFEXITED(status) &&
+	    WEXITSTATUS(status) == 0;
+
+	if (!success)
+		fprintf(stderr, "Failed to invoke command: %s\n",
+			command->command);
+	command->done(command->arg, success);
+	free(command->command);
+	free(command);
+}
+
+// Starts the command and returns without waiting for it; done(done_arg, ...)
+// is called from the event thread when it exits. Returns false, without
+// calling done, if the command could not be started.
 // Note: this method strips out quotes and applies them itself as should be appropriate
-bool run_template(const char *template, const char *mount_point,
-		  const char *root_name)
+bool spawn_template(const char *template, const char *mount_point,
+		    const char *root_name, command_done_t done,
+		    void *done_arg)
 {
 	int len = 0;
 	int nargs = 1;
@@ -381,8 +762,9 @@ bool run_template(const char *template, const char *mount_point,
 	char **args;
 	char **arg;
 	bool quote = false;
+	command_t *command;
 	pid_t pid;
-	int status;
+	int err;
 
 	// calculate length
 	for (i = 0; template[i]; i++)
@@ -449,100 +831,359 @@ bool run_template(const char *template, const char *mount_point,
 	*p = '\0';
 	*arg = NULL;
 
-	pid = fork();
-	if (pid == -1) {
-		fprintf(stderr, "Failed to fork (%s)\n", strerror(errno));
+	if ((err = spawn_command(args, -1, &pid))) {
+		fprintf(stderr, "Failed to invoke command: %s (%s)\n",
+			args[0], strerror(err));
 		free(args);
 		free(buf);
 		return false;
 	}
-	if (pid == 0) {
-		execvp(args[0], args);
-		abort();
-	}
-	pid = waitpid(pid, &status, 0);
-	if (pid == -1) {
-		fprintf(stderr, "Failed to waitpid (%s)\n", strerror(errno));
-		free(args);
-		free(buf);
-		return false;
-	}
-	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
-		fprintf(stderr, "Failed to invoke command: %s\n", args[0]);
-		free(args);
-		free(buf);
-		return false;
+
+	command = my_malloc(sizeof(command_t));
+	command->command = my_strdup(args[0]);
+	command->done = done;
+	command->arg = done_arg;
+	if (event_loop_add_child(pid, command_exited, command) == -1) {
+		// Should never happen, but better block than leak the mount
+		int status = -1;
+
+		perror("Failed to watch command");
+		while (waitpid(pid, &status, 0) == -1 && errno == EINTR) ;
+		command_exited(command, status);
 	}
+
 	free(args);
 	free(buf);
 	return true;
 }
 
-mount_list_t *do_mount(const char *root_name)
+static void mount_command_done(void *arg, bool success)
 {
-	char *mount_point;
-	mount_list_t *mount;
+	mount_list_t *mount = arg;
+	mount_root_t *root = NULL;
+	struct stat st;
+	int fd;
 
-	fprintf(stderr, "Mounting: %s\n", root_name);
+	if (success) {
+		// Operations fall back to the full path if this fails
+		if ((fd = open(mount->mount_point, O_ROOT_FLAGS)) == -1)
+			fprintf(stderr, "Failed to open mount point: %s (%s)\n",
+				mount->mount_point, strerror(errno));
+		else {
+			root = my_malloc(sizeof(mount_root_t));
+			root->fd = fd;
+			root->refcount = 1;	/* The mount's */
+		}
 
-	if (!(mount_point = make_mount_point(root_name))) {
-		fprintf(stderr,
-			"Failed to create mount point directory: %s/%s\n",
-			mount_point_directory, root_name);
-		return NULL;
+		// check_mount() compares against the device
+		if ((fd == -1 ? lstat(mount->mount_point, &st) :
+		     fstat(fd, &st)) == -1 || st.st_dev == mount_point_dev) {
+			fprintf(stderr, "Nothing mounted on: %s\n",
+				mount->mount_point);
+			if (root) {
+				close(root->fd);
+				free(root);
+				root = NULL;
+			}
+			success = false;
+		} else
+			mount->dev = st.st_dev;
 	}
 
-	if (!run_template(user_options.mount_command_template,
-			  mount_point, root_name)) {
+	// Recorded before waking up the waiters, which may try again
+	if (success)
+		mount_backoff_succeeded(mount->root_name,
+					strlen(mount->root_name), mount->hash);
+	else
+		mount_backoff_failed(mount->root_name,
+				     strlen(mount->root_name), mount->hash,
+				     event_loop_now());
+
+	if (!success && mount->mount_point) {
 		// remove the now unused directory
-		if (rmdir(mount_point) == -1)
+		if (rmdir(mount->mount_point) == -1)
 			fprintf(stderr,
 				"Failed to remove mount point dir: %s (%s)",
-				mount_point, strerror(errno));
+				mount->mount_point, strerror(errno));
+	}
 
-		free(mount_point);
-		return NULL;
+	pthread_mutex_lock(&mount_list_lock);
+	if (success) {
+		mount->state = MOUNT_STATE_MOUNTED;
+		mount->root = root;
+		pthread_cond_broadcast(&mount->state_cond);
+		update_auto_unmount(mount);
+	} else
+		remove_mount(mount);
+	/* Drop the reference held by the command */
+	unref_mount(mount);
+	pthread_mutex_unlock(&mount_list_lock);
+}
+
+static void start_mount(mount_list_t * mount)
+{
+	fprintf(stderr, "Mounting: %s\n", mount->root_name);
+
+	if (!(mount->mount_point = make_mount_point(mount->root_name))) {
+		fprintf(stderr,
+			"Failed to create mount point directory: %s/%s\n",
+			mount_point_directory, mount->root_name);
+		mount_command_done(mount, false);
+	} else if (!spawn_template(user_options.mount_command_template,
+				   mount->mount_point, mount->root_name,
+				   mount_command_done, mount))
+		mount_command_done(mount, false);
+}
+
+// Returns the mount for root_name with a reference held, mounting it first
+// if needed, or NULL if mounting failed.
+//
+// Only one mount command is ever run per root: the first thread to access
+// it starts the command, and it and every thread arriving before the
+// command completes wait for its outcome. The command runs in the
+// background so only requests for this root wait on it. With
+// -o mount_backoff, a root whose command failed recently fails right away.
+mount_list_t *do_mount(const root_name_t * root_name)
+{
+	mount_list_t *mount;
+	mount_state_t waited_on;
+
+	pthread_mutex_lock(&mount_list_lock);
+	for (;;) {
+		if (!(mount = find_mount(root_name)) &&
+		    mount_backoff_active(root_name->name, root_name->len,
+					 root_name->hash, event_loop_now())) {
+			fprintf(stderr, "Not mounting: %.*s (failed recently)\n",
+				(int)root_name->len, root_name->name);
+			break;
+		}
+		if (!mount) {
+			mount = add_mount(root_name);
+			/* One more reference for the mount command */
+			mount->refcount++;
+			pthread_mutex_unlock(&mount_list_lock);
+			start_mount(mount);
+			pthread_mutex_lock(&mount_list_lock);
+			waited_on = MOUNT_STATE_MOUNTING;
+		} else {
+			mount->refcount++;
+			waited_on = mount->state;
+		}
+
+		while (mount->state == MOUNT_STATE_MOUNTING ||
+		       mount->state == MOUNT_STATE_UNMOUNTING)
+			pthread_cond_wait(&mount->state_cond, &mount_list_lock);
+
+		if (mount->state == MOUNT_STATE_MOUNTED)
+			break;
+
+		unref_mount(mount);
+		if (waited_on == MOUNT_STATE_MOUNTING) {
+			// The mount we waited for failed, so do we
+			mount = NULL;
+			break;
+		}
+		// An unmount completed, look again
 	}
+	pthread_mutex_unlock(&mount_list_lock);
 
-	mount = add_mount(root_name, mount_point);
 	return mount;
 }
 
-int do_umount(mount_list_t * mount)
+static void unmount_command_done(void *arg, bool success)
 {
-	fprintf(stderr, "Unmounting: %s\n", mount->root_name);
+	mount_list_t *mount = arg;
 
-	run_template(user_options.unmount_command_template,
-		     mount->mount_point, mount->root_name);
-	/* Still unmount anyway */
+	(void)success;		/* Still unmount anyway */
 
 	if (rmdir(mount->mount_point) == -1)
 		fprintf(stderr, "Failed to remove mount point dir: %s (%s)",
 			mount->mount_point, strerror(errno));
+
+	// Whatever the kernel cached below the root came from the filesystem
+	// just unmounted, which the next mount may not match.
+	notifier_forget_root(mount->root_name);
+
+	pthread_mutex_lock(&mount_list_lock);
 	remove_mount(mount);
+	/* Drop the reference held by the command */
+	unref_mount(mount);
+	pthread_mutex_unlock(&mount_list_lock);
+}
+
+// Starts unmounting mount and returns without waiting for the unmount
+// command. The caller must hold a reference to mount, which stays valid.
+// Returns 0 if the mount was not mounted (e.g. is already being unmounted).
+int do_umount(mount_list_t * mount)
+{
+	mount_root_t *root;
+
+	pthread_mutex_lock(&mount_list_lock);
+	if (mount->state != MOUNT_STATE_MOUNTED) {
+		pthread_mutex_unlock(&mount_list_lock);
+		return 0;
+	}
+	// Stays listed until the mount point is gone, so a new mount of
+	// the same root waits for us.
+	mount->state = MOUNT_STATE_UNMOUNTING;
+	/* One more reference for the unmount command */
+	mount->refcount++;
+	update_auto_unmount(mount);
+	root = mount->root;
+	mount->root = NULL;
+	pthread_mutex_unlock(&mount_list_lock);
+
+	put_root(root);
+
+	fprintf(stderr, "Unmounting: %s\n", mount->root_name);
+
+	if (!spawn_template(user_options.unmount_command_template,
+			    mount->mount_point, mount->root_name,
+			    unmount_command_done, mount))
+		unmount_command_done(mount, false);
 	return 1;
 }
 
+// Unmounts everything and waits for the unmount commands to complete.
 void unmount_all(void)
 {
+	mount_list_t *mount, **mounts;
+	size_t i, mount_count;
+
 	fprintf(stderr, "Attempting to unmount all filesystems:\n");
 
-	while (mount_list) {
-		fprintf(stderr, "\tUnmounting: %s\n", mount_list->root_name);
+	mounts = get_all_mounts(&mount_count);
+	for (i = 0; i < mount_count; i++) {
+		fprintf(stderr, "\tUnmounting: %s\n", mounts[i]->root_name);
 
-		do_umount(mount_list);
+		do_umount(mounts[i]);
+		put_mount(mounts[i]);
 	}
+	free(mounts);
+
+	pthread_mutex_lock(&mount_list_lock);
+	while ((mount = mount_list)) {
+		mount->refcount++;
+		if (mount->state == MOUNT_STATE_MOUNTED) {
+			pthread_mutex_unlock(&mount_list_lock);
+			do_umount(mount);
+			pthread_mutex_lock(&mount_list_lock);
+		}
+		while (mount->state == MOUNT_STATE_MOUNTING ||
+		       mount->state == MOUNT_STATE_UNMOUNTING)
+			pthread_cond_wait(&mount->state_cond, &mount_list_lock);
+		unref_mount(mount);
+	}
+	pthread_mutex_unlock(&mount_list_lock);
 
 	fprintf(stderr, "done.\n");
 }
 
-void shutdown(void)
+// Returns the set of mount points listed in /proc/self/mountinfo, or NULL
+// if it can't be read. Only called from the event thread.
+static string_set_t *read_mount_points(void)
+{
+	static char *buf = NULL;
+	static size_t size = 0;
+	string_set_t *mount_points;
+	char *line, *end, *field, *out;
+	size_t len = 0;
+	ssize_t res;
+	int i;
+
+	if (lseek(mountinfo_fd, 0, SEEK_SET) == -1)
+		return NULL;
+	for (;;) {
+		if (size - len < 4096) {
+			size = size ? 2 * size : 65536;
+			buf = my_realloc(buf, size);
+		}
+		if ((res = read(mountinfo_fd, buf + len, size - len - 1)) ==
+		    -1) {
+			if (errno == EINTR)
+				continue;
+			return NULL;
+		}
+		if (!res)
+			break;
+		len += res;
+	}
+	buf[len] = '\0';
+
+	mount_points = string_set_new();
+	for (line = buf; *line; line = end) {
+		if ((end = strchr(line, '\n')))
+			*end++ = '\0';
+		else
+			end = line + strlen(line);
+
+		// Mount ID, parent ID, major:minor and root come first
+		for (i = 0, field = line; i < 4 && field; i++)
+			if ((field = strchr(field, ' ')))
+				field++;
+		if (!field)
+			continue;
+
+		// Unescape the octal escapes of ' ', '\t', '\n' and '\\'
+		for (out = line; *field && *field != ' '; field++)
+			if (field[0] == '\\' && field[1] >= '0' &&
+			    field[1] <= '3' && field[2] >= '0' &&
+			    field[2] <= '7' && field[3] >= '0' &&
+			    field[3] <= '7') {
+				*out++ = (field[1] - '0') << 6 |
+				    (field[2] - '0') << 3 | (field[3] - '0');
+				field += 3;
+			} else
+				*out++ = *field;
+		*out = '\0';
+		string_set_insert(mount_points, line);
+	}
+
+	return mount_points;
+}
+
+// Reaps the mounts that disappeared from /proc/self/mountinfo, which the
+// kernel flags with POLLPRI on every change to the mount table.
+static void mountinfo_changed(void *arg)
 {
-	BLOCK_SIGALRM;
+	mount_list_t **mounts;
+	string_set_t *mount_points;
+	size_t i, mount_count;
 
-	unmount_all();
+	(void)arg;
+	// Taken first, those mounted later may not be listed yet
+	mounts = get_all_mounts(&mount_count);
+	if (!(mount_points = read_mount_points()))
+		perror("Failed to read /proc/self/mountinfo");
+	for (i = 0; i < mount_count; i++) {
+		if (mount_points &&
+		    !string_set_contains(mount_points,
+					 mounts[i]->mount_point)) {
+			fprintf(stderr, "Mount died: %s\n",
+				mounts[i]->root_name);
+			do_umount(mounts[i]);
+		}
+		put_mount(mounts[i]);
+	}
+	if (mount_points)
+		string_set_free(mount_points);
+	free(mounts);
+}
 
-	UNBLOCK_SIGALRM;
+// Runs the auto unmount timer, the mount/unmount command completions, the
+// mountinfo watch and the signals.
+static pthread_t event_thread;
+
+static void *event_thread_main(void *arg)
+{
+	(void)arg;
+	event_loop_run();
+	return NULL;
+}
+
+void shutdown(void)
+{
+	unmount_all();
 
 	if (rmdir(mount_point_directory) == -1)
 		fprintf(stderr,
@@ -550,24 +1191,69 @@ void shutdown(void)
 			mount_point_directory, strerror(errno));
 }
 
-int max_path_out_len(const char *path_in)
+// Per-thread buffers process_path() translates paths into, holding
+// mount_point_directory followed by a '/' at all times. Two paths are
+// needed at once by rename() and link().
+enum {
+	PATH_BUF,
+	PATH_BUF_TO,
+	PATH_BUFS
+};
+
+typedef struct _path_buffers_t {
+	char *buf[PATH_BUFS];
+	size_t size[PATH_BUFS];
+} path_buffers_t;
+
+static pthread_key_t path_buffers_key;
+
+static void free_path_buffers(void *arg)
 {
-	return strlen(mount_point_directory) + strlen(path_in) + 2;
+	path_buffers_t *buffers = arg;
+	int i;
+
+	for (i = 0; i < PATH_BUFS; i++)
+		free(buffers->buf[i]);
+	free(buffers);
 }
 
-// returns true if path is a child directory of a root node
-// e.g. /a/b is a child, /a is not.
-int extract_root_name(const char *path, char *root_name)
+// Returns the calling thread's buffer number i, grown to at least size
+// bytes.
+static char *get_path_buffer(int i, size_t size)
 {
-	int i;
+	path_buffers_t *buffers = pthread_getspecific(path_buffers_key);
+	int j;
+
+	if (!buffers) {
+		buffers = my_malloc(sizeof(path_buffers_t));
+		for (j = 0; j < PATH_BUFS; j++) {
+			buffers->size[j] = mount_point_directory_len + 256;
+			buffers->buf[j] = my_malloc(buffers->size[j]);
+			memcpy(buffers->buf[j], mount_point_directory,
+			       mount_point_directory_len);
+			buffers->buf[j][mount_point_directory_len] = '/';
+		}
+		pthread_setspecific(path_buffers_key, buffers);
+	}
 
-	for (i = 1; path[i] && path[i] != '/'; i++)
-		root_name[i - 1] = path[i];
-	root_name[i - 1] = '\0';
+	if (buffers->size[i] < size) {
+		while (buffers->size[i] < size)
+			buffers->size[i] *= 2;
+		buffers->buf[i] = my_realloc(buffers->buf[i], buffers->size[i]);
+	}
 
-	return strlen(&path[i]);
+	return buffers->buf[i];
 }
 
+// A path translated by process_path(). The *at() system calls take
+// dirfd and rel, the calls without such a variant take path.
+typedef struct _proxy_path_t {
+	char *path;		/* Under mount_point_directory */
+	int dirfd;		/* The mount's root, else AT_FDCWD */
+	const char *rel;	/* Relative to dirfd */
+	mount_root_t *root;	/* Reference held on dirfd, or NULL */
+} proxy_path_t;
+
 typedef enum {
 	PROC_PATH_FAILED,
 	PROC_PATH_ROOT_DIR,
@@ -575,21 +1261,57 @@ typedef enum {
 	PROC_PATH_PROXY_DIR
 } proc_result_t;
 
-proc_result_t process_path(const char *path_in, char *path_out, char *root_name,
+// Translates path_in into the calling thread's buffer number buffer, which
+// is stored in path_out along with the root name of path_in. Both stay
+// valid until the next call using the same buffer. Once done with it,
+// path_out and the mount must be released with put_path().
+proc_result_t process_path(const char *path_in, int buffer,
+			   proxy_path_t * path_out, root_name_t * root_name,
 			   int attempt_mount, mount_list_t ** out_mount)
 {
-	char *path_out_base;
-	int is_child;
-	int len;
+	size_t base = mount_point_directory_len, i, size;
+	uint32_t hash = STR_HASH_INIT;
+	bool is_child = false;
+	char *out;
 	mount_list_t *mount = NULL;
 
 	*out_mount = NULL;
+	path_out->root = NULL;
+
+	// Single pass over path_in, copying it after the "mount_point_directory/"
+	// prefix already in the buffer and hashing the root name on the way.
+	// path_in always starts with a '/', which the prefix ends with.
+	size = base + 256;
+	out = get_path_buffer(buffer, size);
+	for (i = 0; path_in[i]; i++) {
+		if (base + i + 1 >= size) {
+			size *= 2;
+			out = get_path_buffer(buffer, size);
+		}
+		out[base + i] = path_in[i];
+		if (i > 0 && !is_child) {
+			if (path_in[i] == '/') {
+				is_child = true;
+				root_name->len = i - 1;
+			} else
+				hash = STR_HASH_STEP(hash, path_in[i]);
+		}
+	}
+	out[base + i] = '\0';
+	if (!is_child)
+		root_name->len = i - 1;
+	root_name->name = path_in + 1;
+	root_name->hash = hash;
+	path_out->path = out;
+	path_out->dirfd = AT_FDCWD;
+	path_out->rel = out;
 
 	fprintf(stderr, "Path in: %s\n", path_in);
-	is_child = extract_root_name(path_in, root_name);
-	fprintf(stderr, "root_name is: %s\n", root_name);
+	fprintf(stderr, "root_name is: %.*s\n", (int)root_name->len,
+		root_name->name);
 
-	if (is_mount_filtered(root_name))
+	if (mount_filter_match(root_name->name, root_name->len,
+			       root_name->hash))
 		return PROC_PATH_FAILED;
 
 	// Mount filesystem if necessary
@@ -599,55 +1321,87 @@ proc_result_t process_path(const char *path_in, char *path_out, char *root_name,
 	// !!FIXME!! this is broken on FUSE < 2.5 (?) because a getattr
 	// on the root node seems to occur with every single access.
 	if ((is_child || attempt_mount) &&
-	    strlen(root_name) > 0 &&
-	    !(mount = find_mount(root_name)) && !(mount = do_mount(root_name)))
+	    root_name->len > 0 && !(mount = do_mount(root_name)))
 		return PROC_PATH_FAILED;
 
 	if (mount && !check_mount(mount)) {
 		do_umount(mount);
+		put_mount(mount);
 		mount = do_mount(root_name);
 		if (!mount)
 			return PROC_PATH_FAILED;
 	}
-	// construct path_out (mount_point_directory + '/' + path_in + '\0')
-	path_out_base = path_out;
-	len = strlen(mount_point_directory);
-	memcpy(path_out, mount_point_directory, len);
-	path_out += len;
-	*path_out++ = '/';
-	len = strlen(path_in) - 1;
-	memcpy(path_out, path_in + 1, len);
-	path_out += len;
-	*path_out = '\0';
-	fprintf(stderr, "Path out: %s\n", path_out_base);
+	fprintf(stderr, "Path out: %s\n", path_out->path);
 
 	*out_mount = mount;
+	if (mount) {
+		pthread_mutex_lock(&mount_list_lock);
+		if ((path_out->root = mount->root))
+			mount->root->refcount++;
+		pthread_mutex_unlock(&mount_list_lock);
+	}
+	if (path_out->root) {
+		path_out->dirfd = path_out->root->fd;
+		path_out->rel = is_child ? out + base + root_name->len + 2 :
+		    ".";
+	}
 
 	if (is_child)
 		return PROC_PATH_PROXY_DIR;
-	else if (strlen(root_name))
+	else if (root_name->len)
 		return PROC_PATH_ROOT_SUBDIR;
 	else
 		return PROC_PATH_ROOT_DIR;
 }
 
+// Drops the references process_path() took for path and mount, renewing
+// the mount's lease if renew.
+static void drop_path(proxy_path_t * path, mount_list_t * mount, bool renew)
+{
+	mount_root_t *root = path->root;
+	bool last;
+
+	if (!mount)
+		return;
+
+	pthread_mutex_lock(&mount_list_lock);
+	last = unref_root(root);
+	if (renew)
+		update_auto_unmount(mount);
+	unref_mount(mount);
+	pthread_mutex_unlock(&mount_list_lock);
+
+	if (last) {
+		close(root->fd);
+		free(root);
+	}
+}
+
+static void put_path(proxy_path_t * path, mount_list_t * mount)
+{
+	drop_path(path, mount, true);
+}
+
 static int afuse_getattr(const char *path, struct stat *stbuf)
 {
-	char *root_name = alloca(strlen(path));
-	char *real_path = alloca(max_path_out_len(path));
+	root_name_t root_name;
+	proxy_path_t real_path;
 	int retval;
 	mount_list_t *mount;
-	BLOCK_SIGALRM;
+	uint64_t generation = 0;
+	uint32_t hash = 0, stamp = 0;
+	size_t len = 0;
 
 	fprintf(stderr, "> GetAttr\n");
 
-	switch (process_path(path, real_path, root_name, 0, &mount)) {
+	switch (process_path(path, PATH_BUF, &real_path, &root_name, 0, &mount)) {
 	case PROC_PATH_FAILED:
 		retval = -ENXIO;
 		break;
 
 	case PROC_PATH_ROOT_DIR:
-		fprintf(stderr, "Getattr on: (%s) - %s\n", path, root_name);
+		fprintf(stderr, "Getattr on: (%s) - %.*s\n", path,
+			(int)root_name.len, root_name.name);
 		stbuf->st_mode = S_IFDIR | 0700;
 		stbuf->st_nlink = 1;
 		stbuf->st_uid = getuid();
@@ -661,9 +1415,31 @@ static int afuse_getattr(const char *path, struct stat *stbuf)
 		retval = 0;
 		break;
 	case PROC_PATH_ROOT_SUBDIR:
-		if (user_options.exact_getattr)
+		if (user_options.exact_getattr && !user_options.symlink_mounts)
 			/* try to mount it */
-			process_path(path, real_path, root_name, 1, &mount);
+			process_path(path, PATH_BUF, &real_path, &root_name, 1, &mount);
+		// Left to readlink, which every traversal of the symlink
+		// calls, to mount: ls -l of a populated root must not mount
+		// every root listed.
+		if (user_options.symlink_mounts) {
+			stbuf->st_mode = S_IFLNK | 0777;
+			stbuf->st_nlink = 1;
+			stbuf->st_uid = getuid();
+			stbuf->st_gid = getgid();
+			/* What readlink will return, see make_mount_point() */
+			stbuf->st_size = mount_point_directory_len + 1 +
+			    root_name.len;
+			stbuf->st_blksize = 0;
+			stbuf->st_blocks = 0;
+			stbuf->st_atime = 0;
+			stbuf->st_mtime = 0;
+			stbuf->st_ctime = 0;
+			/* Not a use of the mount */
+			drop_path(&real_path, mount, false);
+			mount = NULL;
+			retval = 0;
+			break;
+		}
 		if (!mount) {
 			stbuf->st_mode = S_IFDIR | 0000;
 			if (!user_options.exact_getattr)
@@ -682,28 +1458,44 @@ static int afuse_getattr(const char *path, struct stat *stbuf)
 		}
 
 	case PROC_PATH_PROXY_DIR:
-		retval = get_retval(lstat(real_path, stbuf));
+		if (user_options.attr_cache) {
+			len = strlen(path);
+			hash = str_hash(path);
+			generation = attr_generation(mount);
+			if (attr_cache_get(mount->id, generation, path, len,
+					   hash, stbuf, event_loop_now())) {
+				retval = 0;
+				break;
+			}
+			stamp = attr_cache_stamp(hash);
+		}
+		retval = get_retval(fstatat(real_path.dirfd, real_path.rel, stbuf,
+					    AT_SYMLINK_NOFOLLOW));
+		if (!retval && user_options.attr_cache)
+			attr_cache_put(mount->id, generation, stamp, path, len,
+				       hash, stbuf, event_loop_now());
+		else if (retval == -ENOTCONN)
+			// Its server died but left it mounted, which
+			// mountinfo_changed() can't see
+			do_umount(mount);
 		break;
 
 	default:
 		DEFAULT_CASE_INVALID_ENUM;
 	}
-	if (mount)
-		update_auto_unmount(mount);
-	UNBLOCK_SIGALRM;
+	put_path(&real_path, mount);
 	return retval;
 }
 
 static int afuse_readlink(const char *path, char *buf, size_t size)
 {
 	int res;
-	char *root_name = alloca(strlen(path));
-	char *real_path = alloca(max_path_out_len(path));
+	root_name_t root_name;
+	proxy_path_t real_path;
 	int retval;
 	mount_list_t *mount;
-	BLOCK_SIGALRM;
 
-	switch (process_path(path, real_path, root_name, 1, &mount)) {
+	switch (process_path(path, PATH_BUF, &real_path, &root_name, 1, &mount)) {
 	case PROC_PATH_FAILED:
 		retval = -ENXIO;
 		break;
@@ -715,8 +1507,14 @@ static int afuse_readlink(const char *path, char *buf, size_t size)
 			retval = -ENOENT;
 			break;
 		}
+		if (user_options.symlink_mounts) {
+			strncpy(buf, mount->mount_point, size - 1);
+			buf[size - 1] = '\0';
+			retval = 0;
+			break;
+		}
 	case PROC_PATH_PROXY_DIR:
-		res = readlink(real_path, buf, size - 1);
+		res = readlinkat(real_path.dirfd, real_path.rel, buf, size - 1);
 		if (res == -1) {
 			retval = -errno;
 			break;
@@ -728,26 +1526,25 @@ static int afuse_readlink(const char *path, char *buf, size_t size)
 	default:
 		DEFAULT_CASE_INVALID_ENUM;
 	}
-	if (mount)
-		update_auto_unmount(mount);
-	UNBLOCK_SIGALRM;
+	put_path(&real_path, mount);
 	return retval;
 }
 
 static int afuse_opendir(const char *path, struct fuse_file_info *fi)
 {
-	DIR *dp;
-	char *root_name = alloca(strlen(path));
+	dir_stream_t *dp;
+	int fd;
+	root_name_t root_name;
 	mount_list_t *mount;
-	char *real_path = alloca(max_path_out_len(path));
+	proxy_path_t real_path;
 	int retval;
-	BLOCK_SIGALRM;
 
-	switch (process_path(path, real_path, root_name, 1, &mount)) {
+	switch (process_path(path, PATH_BUF, &real_path, &root_name, 1, &mount)) {
 	case PROC_PATH_FAILED:
 		retval = -ENXIO;
 		break;
 	case PROC_PATH_ROOT_DIR:
+		fi->fh = 0lu;
 		retval = 0;
 		break;
 	case PROC_PATH_ROOT_SUBDIR:
@@ -757,101 +1554,120 @@ static int afuse_opendir(const char *path, struct fuse_file_info *fi)
 			break;
 		}
 	case PROC_PATH_PROXY_DIR:
-		dp = opendir(real_path);
+		// Not to leak into the mount commands spawned meanwhile
+		fd = openat(real_path.dirfd, real_path.rel,
+			    O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (fd == -1) {
+			retval = -errno;
+			break;
+		}
+		dp = dir_stream_open(fd);
 		if (dp == NULL) {
 			retval = -errno;
+			close(fd);
 			break;
 		}
-		fi->fh = (unsigned long)dp;
-		if (mount)
-			dir_list_add(&mount->dir_list, dp);
+		fi->fh = (uintptr_t) new_handle(mount, -1, dp);
 		retval = 0;
 		break;
 
 	default:
 		DEFAULT_CASE_INVALID_ENUM;
 	}
-	if (mount)
-		update_auto_unmount(mount);
-	UNBLOCK_SIGALRM;
+	put_path(&real_path, mount);
 	return retval;
 }
 
-static inline DIR *get_dirp(struct fuse_file_info *fi)
+static inline handle_t *get_handle(struct fuse_file_info *fi)
 {
-	return (DIR *) (uintptr_t) fi->fh;
+	return (handle_t *) (uintptr_t) fi->fh;
 }
 
-int populate_root_dir(char *pop_cmd, struct list_t **dir_entry_listptr,
-		      fuse_fill_dir_t filler, void *buf)
+static inline dir_stream_t *get_dirp(struct fuse_file_info *fi)
 {
-	FILE *browser;
-	size_t hsize = 0;
-	ssize_t hlen;
-	char *dir_entry = NULL;
+	handle_t *handle = get_handle(fi);
 
-	if (!pop_cmd)
-		return -1;
+	return handle ? handle->dir : NULL;
+}
 
-	if ((browser = popen(pop_cmd, "r")) == NULL) {
-		fprintf(stderr, "Failed to execute populate_root_command=%s\n",
-			pop_cmd);
-		return -errno;
-	}
+static inline int get_fd(struct fuse_file_info *fi)
+{
+	return get_handle(fi)->fd;
+}
 
-	int loop_error = 0;
-#ifdef HAVE_GETLINE
-	while ((hlen = getline(&dir_entry, &hsize, browser)) != -1)
-#else				// HAVE_FGETLN
-	while (dir_entry = fgetln(browser, &hsize))
-#endif
-	{
-		if (hlen >= 1 && dir_entry[hlen - 1] == '\n')
-			dir_entry[hlen - 1] = '\0';
+typedef struct _populate_root_t {
+	string_set_t *dir_entries;
+	fuse_fill_dir_t filler;
+	void *buf;
+} populate_root_t;
 
-		fprintf(stderr, "Got entry \"%s\"\n", dir_entry);
+static void populate_root_entry(void *arg, const char *name)
+{
+	populate_root_t *populate = arg;
 
-		int insert_err =
-		    insert_sorted_if_unique(dir_entry_listptr, dir_entry);
-		if (insert_err == 1)	// already in list
-			continue;
-		else if (insert_err) {
-			fprintf(stderr,
-				"populate_root_command: failed on inserting new entry into sorted list.\n");
-			loop_error = 1;
-		}
+	if (!string_set_insert(populate->dir_entries, name))
+		populate->filler(populate->buf, name, NULL, 0);
+}
 
-		if (strlen(dir_entry) != 0)
-			filler(buf, dir_entry, NULL, 0);
-	}
+// Lists the entries of -o populate_root_command not in dir_entries yet.
+int populate_root_dir(string_set_t * dir_entries, fuse_fill_dir_t filler,
+		      void *buf)
+{
+	populate_root_t populate = { dir_entries, filler, buf };
 
-	free(dir_entry);
+	return root_listing_for_each(populate_root_entry, &populate);
+}
 
-	int pclose_err = pclose(browser);
-	if (pclose_err) {
-		int pclose_errno = errno;
-		fprintf(stderr,
-			"populate_root_command: pclose failed, ret %d, status %d, errno %d (%s)\n",
-			pclose_errno, WEXITSTATUS(pclose_errno), pclose_errno,
-			strerror(pclose_errno));
-	}
+// For -o prefetch_attrs: stats the entry name of the directory dp, at
+// dir, into st and caches the result for afuse_getattr(). FUSE 2 has no
+// readdirplus, so the kernel still asks, but the proxied filesystem isn't.
+// dir_hash is the str_hash() of dir followed by a '/'.
+static void prefetch_attrs(mount_list_t * mount, uint64_t generation,
+			   const char *dir, size_t dir_len, uint32_t dir_hash,
+			   dir_stream_t * dp, const char *name, struct stat *st,
+			   int64_t now)
+{
+	size_t name_len = strlen(name), len = dir_len + 1 + name_len, i;
+	uint32_t hash = dir_hash, stamp;
+	struct stat attrs;
+	char buf[256], *child;
 
-	return loop_error || pclose_err;
+	if (!strcmp(name, ".") || !strcmp(name, ".."))
+		return;
+	for (i = 0; i < name_len; i++)
+		hash = STR_HASH_STEP(hash, name[i]);
+	stamp = attr_cache_stamp(hash);
+	if (fstatat(dir_stream_fd(dp), name, &attrs, AT_SYMLINK_NOFOLLOW) ==
+	    -1)
+		return;
+	*st = attrs;
+
+	child = len < sizeof(buf) ? buf : my_malloc(len);
+	memcpy(child, dir, dir_len);
+	child[dir_len] = '/';
+	memcpy(child + dir_len + 1, name, name_len);
+	attr_cache_put(mount->id, generation, stamp, child, len, hash, st,
+		       now);
+	if (child != buf)
+		free(child);
 }
 
 static int afuse_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
 			 off_t offset, struct fuse_file_info *fi)
 {
-	DIR *dp = get_dirp(fi);
-	struct dirent *de;
-	char *root_name = alloca(strlen(path));
-	char *real_path = alloca(max_path_out_len(path));
-	struct list_t *dir_entry_list = NULL;
-	mount_list_t *mount, *next;
+	dir_stream_t *dp = get_dirp(fi);
+	const dir_entry_t *de;
+	root_name_t root_name;
+	proxy_path_t real_path;
+	string_set_t *dir_entries;
+	mount_list_t *mount, **mounts;
+	size_t i, mount_count, path_len = 0;
+	uint64_t generation = 0;
+	uint32_t path_hash = 0;
+	int64_t now = 0;
 	int retval;
-	BLOCK_SIGALRM;
 
-	switch (process_path(path, real_path, root_name, 1, &mount)) {
+	switch (process_path(path, PATH_BUF, &real_path, &root_name, 1, &mount)) {
 	case PROC_PATH_FAILED:
 		retval = -ENXIO;
 		break;
@@ -859,23 +1675,25 @@ static int afuse_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
 	case PROC_PATH_ROOT_DIR:
 		filler(buf, ".", NULL, 0);
 		filler(buf, "..", NULL, 0);
-		insert_sorted_if_unique(&dir_entry_list, ".");
-		insert_sorted_if_unique(&dir_entry_list, "..");
-		for (mount = mount_list; mount; mount = next) {
-			next = mount->next;
+		dir_entries = string_set_new();
+		string_set_insert(dir_entries, ".");
+		string_set_insert(dir_entries, "..");
+		mounts = get_all_mounts(&mount_count);
+		for (i = 0; i < mount_count; i++) {
 			/* Check for dead mounts. */
-			if (!check_mount(mount)) {
-				do_umount(mount);
+			if (!check_mount(mounts[i])) {
+				do_umount(mounts[i]);
 			} else {
-				if (insert_sorted_if_unique
-				    (&dir_entry_list, mount->root_name))
-					retval = -1;
-				filler(buf, mount->root_name, NULL, 0);
+				if (!string_set_insert(dir_entries,
+						       mounts[i]->root_name))
+					filler(buf, mounts[i]->root_name, NULL,
+					       0);
 			}
+			put_mount(mounts[i]);
 		}
-		populate_root_dir(user_options.populate_root_command,
-				  &dir_entry_list, filler, buf);
-		destroy_list(&dir_entry_list);
+		free(mounts);
+		populate_root_dir(dir_entries, filler, buf);
+		string_set_free(dir_entries);
 		mount = NULL;
 		retval = 0;
 		break;
@@ -886,74 +1704,63 @@ static int afuse_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
 			break;
 		}
 	case PROC_PATH_PROXY_DIR:
-		seekdir(dp, offset);
-		while ((de = readdir(dp)) != NULL) {
+		if (user_options.prefetch_attrs) {
+			generation = attr_generation(mount);
+			now = event_loop_now();
+			path_len = strlen(path);
+			path_hash = STR_HASH_STEP(str_hash(path), '/');
+		}
+		if (!dp) {
+			retval = -EBADF;
+			break;
+		}
+		if ((retval = dir_stream_seek(dp, offset)))
+			break;
+		// An entry filler() has no room for stays in the stream, for
+		// the next call to start from
+		while ((de = dir_stream_peek(dp)) != NULL) {
 			struct stat st;
 			memset(&st, 0, sizeof(st));
-			st.st_ino = de->d_ino;
-			st.st_mode = de->d_type << 12;
-			if (filler(buf, de->d_name, &st, telldir(dp)))
+			st.st_ino = de->ino;
+			st.st_mode = de->type << 12;
+			if (user_options.prefetch_attrs)
+				prefetch_attrs(mount, generation, path,
+					       path_len, path_hash, dp,
+					       de->name, &st, now);
+			if (filler(buf, de->name, &st, de->next))
 				break;
+			dir_stream_next(dp);
 		}
-		retval = 0;
+		if (!de && errno)
+			retval = -errno;
 		break;
 
 	default:
 		DEFAULT_CASE_INVALID_ENUM;
 	}
-	if (mount)
-		update_auto_unmount(mount);
-	UNBLOCK_SIGALRM;
+	put_path(&real_path, mount);
 	return retval;
 }
 
 static int afuse_releasedir(const char *path, struct fuse_file_info *fi)
 {
-	DIR *dp = get_dirp(fi);
-	mount_list_t *mount;
-	char *root_name = alloca(strlen(path));
-	char *real_path = alloca(max_path_out_len(path));
-	int retval;
-
-	BLOCK_SIGALRM;
+	handle_t *handle = get_handle(fi);
 
-	switch (process_path(path, real_path, root_name, 1, &mount)) {
-	case PROC_PATH_FAILED:
-		retval = -ENXIO;
-		break;
-
-	case PROC_PATH_ROOT_DIR:
-		retval = 0;
-		break;
-
-	case PROC_PATH_ROOT_SUBDIR:
-	case PROC_PATH_PROXY_DIR:
-		if (mount)
-			dir_list_remove(&mount->dir_list, dp);
-		if (dp)
-			closedir(dp);
-		retval = 0;
-		break;
-
-	default:
-		DEFAULT_CASE_INVALID_ENUM;
-	}
-	if (mount)
-		update_auto_unmount(mount);
-	UNBLOCK_SIGALRM;
-	return retval;
+	(void)path;
+	if (handle)
+		free_handle(handle);
+	return 0;
 }
 
 static int afuse_mknod(const char *path, mode_t mode, dev_t rdev)
 {
-	char *root_name = alloca(strlen(path));
-	char *real_path = alloca(max_path_out_len(path));
+	root_name_t root_name;
+	proxy_path_t real_path;
 	mount_list_t *mount;
 	int retval;
-	BLOCK_SIGALRM;
 	fprintf(stderr, "> Mknod\n");
 
-	switch (process_path(path, real_path, root_name, 0, &mount)) {
+	switch (process_path(path, PATH_BUF, &real_path, &root_name, 0, &mount)) {
 	case PROC_PATH_FAILED:
 		retval = -ENXIO;
 		break;
@@ -965,29 +1772,29 @@ static int afuse_mknod(const char *path, mode_t mode, dev_t rdev)
 
 	case PROC_PATH_PROXY_DIR:
 		if (S_ISFIFO(mode))
-			retval = get_retval(mkfifo(real_path, mode));
+			retval = get_retval(mkfifoat(real_path.dirfd,
+						      real_path.rel, mode));
 		else
-			retval = get_retval(mknod(real_path, mode, rdev));
+			retval = get_retval(mknodat(real_path.dirfd,
+						      real_path.rel, mode, rdev));
+		invalidate_entry(mount, path);
 		break;
 
 	default:
 		DEFAULT_CASE_INVALID_ENUM;
 	}
-	if (mount)
-		update_auto_unmount(mount);
-	UNBLOCK_SIGALRM;
+	put_path(&real_path, mount);
 	return retval;
 }
 
 static int afuse_mkdir(const char *path, mode_t mode)
 {
-	char *root_name = alloca(strlen(path));
-	char *real_path = alloca(max_path_out_len(path));
+	root_name_t root_name;
+	proxy_path_t real_path;
 	int retval;
 	mount_list_t *mount;
-	BLOCK_SIGALRM;
 
-	switch (process_path(path, real_path, root_name, 0, &mount)) {
+	switch (process_path(path, PATH_BUF, &real_path, &root_name, 0, &mount)) {
 	case PROC_PATH_FAILED:
 		retval = -ENXIO;
 		break;
@@ -996,56 +1803,62 @@ static int afuse_mkdir(const char *path, mode_t mode)
 		retval = -ENOTSUP;
 		break;
 	case PROC_PATH_PROXY_DIR:
-		retval = get_retval(mkdir(real_path, mode));
+		retval = get_retval(mkdirat(real_path.dirfd, real_path.rel,
+					    mode));
+		invalidate_entry(mount, path);
 		break;
 
 	default:
 		DEFAULT_CASE_INVALID_ENUM;
 	}
-	if (mount)
-		update_auto_unmount(mount);
-	UNBLOCK_SIGALRM;
+	put_path(&real_path, mount);
 	return retval;
 }
 
 static int afuse_unlink(const char *path)
 {
-	char *root_name = alloca(strlen(path));
-	char *real_path = alloca(max_path_out_len(path));
+	root_name_t root_name;
+	proxy_path_t real_path;
 	mount_list_t *mount;
 	int retval;
-	BLOCK_SIGALRM;
 
-	switch (process_path(path, real_path, root_name, 0, &mount)) {
+	switch (process_path(path, PATH_BUF, &real_path, &root_name, 0, &mount)) {
 	case PROC_PATH_FAILED:
 		retval = -ENXIO;
 		break;
 	case PROC_PATH_ROOT_DIR:
-	case PROC_PATH_ROOT_SUBDIR:
 		retval = -ENOTSUP;
 		break;
+	case PROC_PATH_ROOT_SUBDIR:
+		/* Unmount, as rmdir() does without symlink_mounts */
+		if (user_options.symlink_mounts &&
+		    (mount = get_mount(&root_name))) {
+			do_umount(mount);
+			retval = 0;
+		} else
+			retval = -ENOTSUP;
+		break;
 	case PROC_PATH_PROXY_DIR:
-		retval = get_retval(unlink(real_path));
+		retval = get_retval(unlinkat(real_path.dirfd, real_path.rel,
+					     0));
+		invalidate_entry(mount, path);
 		break;
 
 	default:
 		DEFAULT_CASE_INVALID_ENUM;
 	}
-	if (mount)
-		update_auto_unmount(mount);
-	UNBLOCK_SIGALRM;
+	put_path(&real_path, mount);
 	return retval;
 }
 
 static int afuse_rmdir(const char *path)
 {
-	char *root_name = alloca(strlen(path));
-	char *real_path = alloca(max_path_out_len(path));
+	root_name_t root_name;
+	proxy_path_t real_path;
 	mount_list_t *mount;
 	int retval;
-	BLOCK_SIGALRM;
 
-	switch (process_path(path, real_path, root_name, 0, &mount)) {
+	switch (process_path(path, PATH_BUF, &real_path, &root_name, 0, &mount)) {
 	case PROC_PATH_FAILED:
 		retval = -ENXIO;
 		break;
@@ -1055,38 +1868,44 @@ static int afuse_rmdir(const char *path)
 	case PROC_PATH_ROOT_SUBDIR:
 		if (mount) {
 			/* Unmount */
-			if (mount->dir_list || mount->fd_list)
+			if (mount_has_handles(mount))
 				retval = -EBUSY;
 			else {
+				/* Or it would keep the filesystem busy */
+				put_root(real_path.root);
+				real_path.root = NULL;
 				do_umount(mount);
-				mount = NULL;
 				retval = 0;
 			}
-		} else
+		} else if (mount_backoff_reset(root_name.name, root_name.len,
+					       root_name.hash))
+			/* Have the next access try mounting it again */
+			retval = 0;
+		else
 			retval = -ENOTSUP;
 		break;
 	case PROC_PATH_PROXY_DIR:
-		retval = get_retval(rmdir(real_path));
+		retval = get_retval(unlinkat(real_path.dirfd, real_path.rel,
+					     AT_REMOVEDIR));
+		invalidate_entry(mount, path);
 		break;
 
 	default:
 		DEFAULT_CASE_INVALID_ENUM;
 	}
-	if (mount)
-		update_auto_unmount(mount);
-	UNBLOCK_SIGALRM;
+	put_path(&real_path, mount);
 	return retval;
 }
 
 static int afuse_symlink(const char *from, const char *to)
 {
-	char *root_name_to = alloca(strlen(to));
-	char *real_to_path = alloca(max_path_out_len(to));
+	root_name_t root_name_to;
+	proxy_path_t real_to_path;
 	mount_list_t *mount;
 	int retval;
-	BLOCK_SIGALRM;
 
-	switch (process_path(to, real_to_path, root_name_to, 0, &mount)) {
+	switch (process_path(to, PATH_BUF, &real_to_path, &root_name_to, 0,
+			     &mount)) {
 	case PROC_PATH_FAILED:
 		retval = -ENXIO;
 		break;
@@ -1095,30 +1914,28 @@ static int afuse_symlink(const char *from, const char *to)
 		retval = -ENOTSUP;
 		break;
 	case PROC_PATH_PROXY_DIR:
-		retval = get_retval(symlink(from, real_to_path));
+		retval = get_retval(symlinkat(from, real_to_path.dirfd,
+					      real_to_path.rel));
+		invalidate_entry(mount, to);
 		break;
 
 	default:
 		DEFAULT_CASE_INVALID_ENUM;
 	}
-	if (mount)
-		update_auto_unmount(mount);
-	UNBLOCK_SIGALRM;
+	put_path(&real_to_path, mount);
 	return retval;
 }
 
 static int afuse_rename(const char *from, const char *to)
 {
-	char *root_name_from = alloca(strlen(from));
-	char *root_name_to = alloca(strlen(to));
-	char *real_from_path = alloca(max_path_out_len(from));
-	char *real_to_path = alloca(max_path_out_len(to));
+	root_name_t root_name_from, root_name_to;
+	proxy_path_t real_from_path, real_to_path;
 	mount_list_t *mount_from, *mount_to = NULL;
+	struct stat st;
 	int retval;
-	BLOCK_SIGALRM;
 
-	switch (process_path
-		(from, real_from_path, root_name_from, 0, &mount_from)) {
+	switch (process_path(from, PATH_BUF, &real_from_path,
+			     &root_name_from, 0, &mount_from)) {
 
 	case PROC_PATH_FAILED:
 		retval = -ENXIO;
@@ -1130,8 +1947,8 @@ static int afuse_rename(const char *from, const char *to)
 		break;
 
 	case PROC_PATH_PROXY_DIR:
-		switch (process_path
-			(to, real_to_path, root_name_to, 0, &mount_to)) {
+		switch (process_path(to, PATH_BUF_TO, &real_to_path,
+				     &root_name_to, 0, &mount_to)) {
 
 		case PROC_PATH_FAILED:
 			retval = -ENXIO;
@@ -1143,8 +1960,21 @@ static int afuse_rename(const char *from, const char *to)
 			break;
 
 		case PROC_PATH_PROXY_DIR:
-			retval =
-			    get_retval(rename(real_from_path, real_to_path));
+			retval = get_retval(renameat(real_from_path.dirfd,
+						     real_from_path.rel,
+						     real_to_path.dirfd,
+						     real_to_path.rel));
+			// Renaming a directory moves every path under it
+			if (user_options.attr_cache &&
+			    (fstatat(real_to_path.dirfd, real_to_path.rel, &st,
+				     AT_SYMLINK_NOFOLLOW) == -1 ||
+			     S_ISDIR(st.st_mode))) {
+				invalidate_attrs(mount_to);
+				invalidate_attrs(mount_from);
+			} else {
+				invalidate_entry(mount_from, from);
+				invalidate_entry(mount_to, to);
+			}
 			break;
 
 		default:
@@ -1155,26 +1985,20 @@ static int afuse_rename(const char *from, const char *to)
 	default:
 		DEFAULT_CASE_INVALID_ENUM;
 	}
-	if (mount_to)
-		update_auto_unmount(mount_to);
-	if (mount_from && mount_from != mount_to)
-		update_auto_unmount(mount_from);
-	UNBLOCK_SIGALRM;
+	put_path(&real_to_path, mount_to);
+	put_path(&real_from_path, mount_from);
 	return retval;
 }
 
 static int afuse_link(const char *from, const char *to)
 {
-	char *root_name_from = alloca(strlen(from));
-	char *root_name_to = alloca(strlen(to));
-	char *real_from_path = alloca(max_path_out_len(from));
-	char *real_to_path = alloca(max_path_out_len(to));
+	root_name_t root_name_from, root_name_to;
+	proxy_path_t real_from_path, real_to_path;
 	mount_list_t *mount_to = NULL, *mount_from;
 	int retval;
-	BLOCK_SIGALRM;
 
-	switch (process_path
-		(from, real_from_path, root_name_from, 0, &mount_from)) {
+	switch (process_path(from, PATH_BUF, &real_from_path,
+			     &root_name_from, 0, &mount_from)) {
 
 	case PROC_PATH_FAILED:
 		retval = -ENXIO;
@@ -1184,8 +2008,8 @@ static int afuse_link(const char *from, const char *to)
 		retval = -ENOTSUP;
 		break;
 	case PROC_PATH_PROXY_DIR:
-		switch (process_path
-			(to, real_to_path, root_name_to, 0, &mount_to)) {
+		switch (process_path(to, PATH_BUF_TO, &real_to_path,
+				     &root_name_to, 0, &mount_to)) {
 
 		case PROC_PATH_FAILED:
 			retval = -ENXIO;
@@ -1195,7 +2019,13 @@ static int afuse_link(const char *from, const char *to)
 			retval = -ENOTSUP;
 			break;
 		case PROC_PATH_PROXY_DIR:
-			retval = get_retval(link(real_from_path, real_to_path));
+			retval = get_retval(linkat(real_from_path.dirfd,
+						   real_from_path.rel,
+						   real_to_path.dirfd,
+						   real_to_path.rel, 0));
+			// The link count of from changes too
+			invalidate_path(mount_from, from);
+			invalidate_entry(mount_to, to);
 			break;
 
 		default:
@@ -1206,23 +2036,19 @@ static int afuse_link(const char *from, const char *to)
 	default:
 		DEFAULT_CASE_INVALID_ENUM;
 	}
-	if (mount_to)
-		update_auto_unmount(mount_to);
-	if (mount_from && mount_from != mount_to)
-		update_auto_unmount(mount_from);
-	UNBLOCK_SIGALRM;
+	put_path(&real_to_path, mount_to);
+	put_path(&real_from_path, mount_from);
 	return retval;
 }
 
 static int afuse_chmod(const char *path, mode_t mode)
 {
-	char *root_name = alloca(strlen(path));
-	char *real_path = alloca(max_path_out_len(path));
+	root_name_t root_name;
+	proxy_path_t real_path;
 	mount_list_t *mount;
 	int retval;
-	BLOCK_SIGALRM;
 
-	switch (process_path(path, real_path, root_name, 0, &mount)) {
+	switch (process_path(path, PATH_BUF, &real_path, &root_name, 0, &mount)) {
 	case PROC_PATH_FAILED:
 		retval = -ENXIO;
 		break;
@@ -1231,27 +2057,26 @@ static int afuse_chmod(const char *path, mode_t mode)
 		retval = -ENOTSUP;
 		break;
 	case PROC_PATH_PROXY_DIR:
-		retval = get_retval(chmod(real_path, mode));
+		retval = get_retval(fchmodat(real_path.dirfd, real_path.rel,
+					     mode, 0));
+		invalidate_path(mount, path);
 		break;
 
 	default:
 		DEFAULT_CASE_INVALID_ENUM;
 	}
-	if (mount)
-		update_auto_unmount(mount);
-	UNBLOCK_SIGALRM;
+	put_path(&real_path, mount);
 	return retval;
 }
 
 static int afuse_chown(const char *path, uid_t uid, gid_t gid)
 {
-	char *root_name = alloca(strlen(path));
-	char *real_path = alloca(max_path_out_len(path));
+	root_name_t root_name;
+	proxy_path_t real_path;
 	mount_list_t *mount;
 	int retval;
-	BLOCK_SIGALRM;
 
-	switch (process_path(path, real_path, root_name, 0, &mount)) {
+	switch (process_path(path, PATH_BUF, &real_path, &root_name, 0, &mount)) {
 	case PROC_PATH_FAILED:
 		retval = -ENXIO;
 		break;
@@ -1260,27 +2085,26 @@ static int afuse_chown(const char *path, uid_t uid, gid_t gid)
 		retval = -ENOTSUP;
 		break;
 	case PROC_PATH_PROXY_DIR:
-		retval = get_retval(lchown(real_path, uid, gid));
+		retval = get_retval(fchownat(real_path.dirfd, real_path.rel,
+					     uid, gid, AT_SYMLINK_NOFOLLOW));
+		invalidate_path(mount, path);
 		break;
 
 	default:
 		DEFAULT_CASE_INVALID_ENUM;
 	}
-	if (mount)
-		update_auto_unmount(mount);
-	UNBLOCK_SIGALRM;
+	put_path(&real_path, mount);
 	return retval;
 }
 
 static int afuse_truncate(const char *path, off_t size)
 {
-	char *root_name = alloca(strlen(path));
-	char *real_path = alloca(max_path_out_len(path));
+	root_name_t root_name;
+	proxy_path_t real_path;
 	mount_list_t *mount;
 	int retval;
-	BLOCK_SIGALRM;
 
-	switch (process_path(path, real_path, root_name, 0, &mount)) {
+	switch (process_path(path, PATH_BUF, &real_path, &root_name, 0, &mount)) {
 	case PROC_PATH_FAILED:
 		retval = -ENXIO;
 		break;
@@ -1289,27 +2113,26 @@ static int afuse_truncate(const char *path, off_t size)
 		retval = -ENOTSUP;
 		break;
 	case PROC_PATH_PROXY_DIR:
-		retval = get_retval(truncate(real_path, size));
+		retval = get_retval(truncate(real_path.path, size));
+		invalidate_path(mount, path);
 		break;
 
 	default:
 		DEFAULT_CASE_INVALID_ENUM;
 	}
-	if (mount)
-		update_auto_unmount(mount);
-	UNBLOCK_SIGALRM;
+	put_path(&real_path, mount);
 	return retval;
 }
 
 static int afuse_utime(const char *path, struct utimbuf *buf)
 {
-	char *root_name = alloca(strlen(path));
-	char *real_path = alloca(max_path_out_len(path));
+	root_name_t root_name;
+	proxy_path_t real_path;
+	struct timespec times[2];
 	mount_list_t *mount;
 	int retval;
-	BLOCK_SIGALRM;
 
-	switch (process_path(path, real_path, root_name, 0, &mount)) {
+	switch (process_path(path, PATH_BUF, &real_path, &root_name, 0, &mount)) {
 	case PROC_PATH_FAILED:
 		retval = -ENXIO;
 		break;
@@ -1322,28 +2145,33 @@ static int afuse_utime(const char *path, struct utimbuf *buf)
 			break;
 		}
 	case PROC_PATH_PROXY_DIR:
-		retval = get_retval(utime(real_path, buf));
+		if (buf) {
+			times[0].tv_sec = buf->actime;
+			times[0].tv_nsec = 0;
+			times[1].tv_sec = buf->modtime;
+			times[1].tv_nsec = 0;
+		}
+		retval = get_retval(utimensat(real_path.dirfd, real_path.rel,
+					      buf ? times : NULL, 0));
+		invalidate_path(mount, path);
 		break;
 
 	default:
 		DEFAULT_CASE_INVALID_ENUM;
 	}
-	if (mount)
-		update_auto_unmount(mount);
-	UNBLOCK_SIGALRM;
+	put_path(&real_path, mount);
 	return retval;
 }
 
 static int afuse_open(const char *path, struct fuse_file_info *fi)
 {
 	int fd;
-	char *root_name = alloca(strlen(path));
+	root_name_t root_name;
 	mount_list_t *mount;
-	char *real_path = alloca(max_path_out_len(path));
+	proxy_path_t real_path;
 	int retval;
-	BLOCK_SIGALRM;
 
-	switch (process_path(path, real_path, root_name, 1, &mount)) {
+	switch (process_path(path, PATH_BUF, &real_path, &root_name, 1, &mount)) {
 	case PROC_PATH_FAILED:
 		retval = -ENXIO;
 		break;
@@ -1352,24 +2180,25 @@ static int afuse_open(const char *path, struct fuse_file_info *fi)
 		retval = -ENOENT;
 		break;
 	case PROC_PATH_PROXY_DIR:
-		fd = open(real_path, fi->flags);
+		fd = openat(real_path.dirfd, real_path.rel,
+			    fi->flags | O_CLOEXEC);
 		if (fd == -1) {
 			retval = -errno;
 			break;
 		}
+		if (fi->flags & O_TRUNC)
+			invalidate_path(mount, path);
 
-		fi->fh = fd;
-		if (mount)
-			fd_list_add(&mount->fd_list, fd);
+		fi->fh = (uintptr_t) new_handle(mount, fd, NULL);
+		get_handle(fi)->sync_io = fi->flags & (O_SYNC | O_DSYNC);
+		fi->keep_cache = mount->keep_cache;
 		retval = 0;
 		break;
 
 	default:
 		DEFAULT_CASE_INVALID_ENUM;
 	}
-	if (mount)
-		update_auto_unmount(mount);
-	UNBLOCK_SIGALRM;
+	put_path(&real_path, mount);
 	return retval;
 }
 
@@ -1379,7 +2208,7 @@ static int afuse_read(const char *path, char *buf, size_t size, off_t offset,
 	int res;
 
 	(void)path;
-	res = pread(fi->fh, buf, size, offset);
+	res = pread(get_fd(fi), buf, size, offset);
 	if (res == -1)
 		res = -errno;
 
@@ -1389,76 +2218,152 @@ static int afuse_read(const char *path, char *buf, size_t size, off_t offset,
 static int afuse_write(const char *path, const char *buf, size_t size,
 		       off_t offset, struct fuse_file_info *fi)
 {
-	int res;
+	int res, err;
 
-	(void)path;
-	res = pwrite(fi->fh, buf, size, offset);
+	res = pwrite(get_fd(fi), buf, size, offset);
 	if (res == -1)
 		res = -errno;
+	invalidate_path(get_handle(fi)->mount, path);
 
-	if (user_options.flush_writes)
-		fsync(fi->fh);
+	if (res >= 0 && user_options.flush_writes && !get_handle(fi)->sync_io &&
+	    (err = flusher_wrote(get_handle(fi), res)))
+		res = err;
 
 	return res;
 }
 
-static int afuse_release(const char *path, struct fuse_file_info *fi)
+// Copies between proxied files always come through here as reads and
+// writes: FUSE 2 has no copy_file_range operation (FUSE 3.4 added one), and
+// forwarding FICLONE is impossible as its argument is a file descriptor of
+// the calling process. Splicing at least keeps the data out of afuse.
+#if FUSE_VERSION >= 29
+// Hands libfuse the file descriptor rather than the data, so it can splice
+// straight from the proxied file to /dev/fuse.
+static int afuse_read_buf(const char *path, struct fuse_bufvec **bufp,
+			  size_t size, off_t offset, struct fuse_file_info *fi)
 {
-	char *root_name = alloca(strlen(path));
-	mount_list_t *mount;
-	int retval;
-	BLOCK_SIGALRM;
+	struct fuse_bufvec *src;
 
-	extract_root_name(path, root_name);
-	mount = find_mount(root_name);
-	retval = get_retval(close(fi->fh));
+	(void)path;
+	src = my_malloc(sizeof(struct fuse_bufvec));
+	*src = FUSE_BUFVEC_INIT(size);
+	src->buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+	src->buf[0].fd = get_fd(fi);
+	src->buf[0].pos = offset;
+	*bufp = src;
 
-	if (mount) {
-		fd_list_remove(&mount->fd_list, fi->fh);
-		update_auto_unmount(mount);
-	}
+	return 0;
+}
 
-	UNBLOCK_SIGALRM;
-	return retval;
+// buf is still in the pipe the request was spliced into when possible,
+// fuse_buf_copy() then splices it to the proxied file.
+static int afuse_write_buf(const char *path, struct fuse_bufvec *buf,
+			   off_t offset, struct fuse_file_info *fi)
+{
+	struct fuse_bufvec dst = FUSE_BUFVEC_INIT(fuse_buf_size(buf));
+	ssize_t res;
+	int err;
+
+	dst.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+	dst.buf[0].fd = get_fd(fi);
+	dst.buf[0].pos = offset;
+	res = fuse_buf_copy(&dst, buf, FUSE_BUF_SPLICE_NONBLOCK);
+	invalidate_path(get_handle(fi)->mount, path);
+
+	if (res >= 0 && user_options.flush_writes && !get_handle(fi)->sync_io &&
+	    (err = flusher_wrote(get_handle(fi), res)))
+		res = err;
+
+	return res;
+}
+#endif
+
+// Called on every close() of the file. With -o flushwrites, returns once
+// the writes made through it are durable.
+static int afuse_flush(const char *path, struct fuse_file_info *fi)
+{
+	(void)path;
+	if (!user_options.flush_writes)
+		return 0;
+	return flusher_flush(get_handle(fi));
+}
+
+static int afuse_release(const char *path, struct fuse_file_info *fi)
+{
+	(void)path;
+	return get_retval(free_handle(get_handle(fi)));
 }
 
 static int afuse_fsync(const char *path, int isdatasync,
 		       struct fuse_file_info *fi)
 {
-	int res;
+	int res, err = 0;
 	(void)path;
 
+	// The sync below covers the handle's batched writes, but a failed
+	// background sync must still be reported
+	if (user_options.flush_writes)
+		err = flusher_forget(get_handle(fi));
+
 #ifndef HAVE_FDATASYNC
 	(void)isdatasync;
 #else
 	if (isdatasync)
-		res = fdatasync(fi->fh);
+		res = fdatasync(get_fd(fi));
 	else
 #endif
-		res = fsync(fi->fh);
-	return get_retval(res);
+		res = fsync(get_fd(fi));
+	res = get_retval(res);
+
+	return res ? res : err;
+}
+
+#if FUSE_VERSION >= 29
+static int afuse_fallocate(const char *path, int mode, off_t offset,
+			   off_t length, struct fuse_file_info *fi)
+{
+	int res;
+
+#ifdef HAVE_FALLOCATE
+	res = get_retval(fallocate(get_fd(fi), mode, offset, length));
+#elif defined(HAVE_POSIX_FALLOCATE)
+	if (mode)
+		res = -EOPNOTSUPP;
+	else
+		res = -posix_fallocate(get_fd(fi), offset, length);
+#else
+	(void)mode;
+	(void)offset;
+	(void)length;
+	res = -EOPNOTSUPP;
+#endif
+	invalidate_path(get_handle(fi)->mount, path);
+
+	return res;
 }
+#endif
 
 #if FUSE_VERSION >= 25
 static int afuse_access(const char *path, int mask)
 {
-	char *root_name = alloca(strlen(path));
-	char *real_path = alloca(max_path_out_len(path));
+	root_name_t root_name;
+	proxy_path_t real_path;
 	mount_list_t *mount;
 	int retval;
-	BLOCK_SIGALRM;
 
-	switch (process_path(path, real_path, root_name, 1, &mount)) {
+	switch (process_path(path, PATH_BUF, &real_path, &root_name, 1, &mount)) {
 	case PROC_PATH_FAILED:
 		retval = -ENXIO;
 		break;
 	case PROC_PATH_ROOT_DIR:
 	case PROC_PATH_PROXY_DIR:
-		retval = get_retval(access(real_path, mask));
+		retval = get_retval(faccessat(real_path.dirfd, real_path.rel,
+					      mask, 0));
 		break;
 	case PROC_PATH_ROOT_SUBDIR:
 		if (mount)
-			retval = get_retval(access(real_path, mask));
+			retval = get_retval(faccessat(real_path.dirfd, real_path.rel,
+					      mask, 0));
 		else
 			retval = -EACCES;
 		break;
@@ -1466,30 +2371,33 @@ static int afuse_access(const char *path, int mask)
 	default:
 		DEFAULT_CASE_INVALID_ENUM;
 	}
-	if (mount)
-		update_auto_unmount(mount);
-	UNBLOCK_SIGALRM;
+	put_path(&real_path, mount);
 	return retval;
 }
 
 static int afuse_ftruncate(const char *path, off_t size,
 			   struct fuse_file_info *fi)
 {
-	(void)path;
-	return get_retval(ftruncate(fi->fh, size));
+	int res;
+
+	res = ftruncate(get_fd(fi), size);
+	invalidate_path(get_handle(fi)->mount, path);
+	return get_retval(res);
 }
 
 static int afuse_create(const char *path, mode_t mode,
 			struct fuse_file_info *fi)
 {
 	int fd;
-	char *root_name = alloca(strlen(path));
-	char *real_path = alloca(max_path_out_len(path));
+	root_name_t root_name;
+	proxy_path_t real_path;
 	mount_list_t *mount;
+	struct stat st;
+	uint64_t generation;
+	uint32_t hash, stamp;
 	int retval;
-	BLOCK_SIGALRM;
 
-	switch (process_path(path, real_path, root_name, 0, &mount)) {
+	switch (process_path(path, PATH_BUF, &real_path, &root_name, 0, &mount)) {
 	case PROC_PATH_FAILED:
 		retval = -ENXIO;
 		break;
@@ -1498,21 +2406,33 @@ static int afuse_create(const char *path, mode_t mode,
 		retval = -ENOTSUP;
 		break;
 	case PROC_PATH_PROXY_DIR:
-		fd = open(real_path, fi->flags, mode);
+		fd = openat(real_path.dirfd, real_path.rel,
+			    fi->flags | O_CLOEXEC, mode);
 		if (fd == -1) {
 			retval = -errno;
 			break;
 		}
-		fi->fh = fd;
+		invalidate_entry(mount, path);
+		if (user_options.attr_cache) {
+			// Build tools stat what they have just created
+			hash = str_hash(path);
+			generation = attr_generation(mount);
+			stamp = attr_cache_stamp(hash);
+			if (fstat(fd, &st) == 0)
+				attr_cache_put(mount->id, generation, stamp,
+					       path, strlen(path), hash, &st,
+					       event_loop_now());
+		}
+		fi->fh = (uintptr_t) new_handle(mount, fd, NULL);
+		get_handle(fi)->sync_io = fi->flags & (O_SYNC | O_DSYNC);
+		fi->keep_cache = mount->keep_cache;
 		retval = 0;
 		break;
 
 	default:
 		DEFAULT_CASE_INVALID_ENUM;
 	}
-	if (mount)
-		update_auto_unmount(mount);
-	UNBLOCK_SIGALRM;
+	put_path(&real_path, mount);
 	return retval;
 }
 
@@ -1521,7 +2441,7 @@ static int afuse_fgetattr(const char *path, struct stat *stbuf,
 {
 	(void)path;
 
-	return get_retval(fstat(fi->fh, stbuf));
+	return get_retval(fstat(get_fd(fi), stbuf));
 }
 #endif
 
@@ -1531,13 +2451,12 @@ static int afuse_statfs(const char *path, struct statvfs *stbuf)
 static int afuse_statfs(const char *path, struct statfs *stbuf)
 #endif
 {
-	char *root_name = alloca(strlen(path));
-	char *real_path = alloca(max_path_out_len(path));
+	root_name_t root_name;
+	proxy_path_t real_path;
 	mount_list_t *mount;
 	int retval;
-	BLOCK_SIGALRM;
 
-	switch (process_path(path, real_path, root_name, 1, &mount)) {
+	switch (process_path(path, PATH_BUF, &real_path, &root_name, 1, &mount)) {
 	case PROC_PATH_FAILED:
 		retval = -ENXIO;
 		break;
@@ -1564,18 +2483,37 @@ static int afuse_statfs(const char *path, struct statfs *stbuf)
 			break;
 		}
 	case PROC_PATH_PROXY_DIR:
-		retval = get_retval(statvfs(real_path, stbuf));
+		retval = get_retval(statvfs(real_path.path, stbuf));
 		break;
 
 	default:
 		DEFAULT_CASE_INVALID_ENUM;
 	}
-	if (mount)
-		update_auto_unmount(mount);
-	UNBLOCK_SIGALRM;
+	put_path(&real_path, mount);
 	return retval;
 }
 
+void *afuse_init(struct fuse_conn_info *conn)
+{
+#ifdef FUSE_CAP_BIG_WRITES
+	// Let writes be as large as max_write rather than a page each.
+	// max_write and max_readahead already default to the most libfuse's
+	// buffers and the kernel allow.
+	conn->want |= conn->capable & FUSE_CAP_BIG_WRITES;
+#endif
+#if FUSE_VERSION >= 29
+	// Have requests spliced into a pipe and replies spliced out of one,
+	// which afuse_read_buf()/afuse_write_buf() pass on without copying.
+	// -o no_splice_read/no_splice_write still take precedence.
+	conn->want |= conn->capable &
+	    (FUSE_CAP_SPLICE_READ | FUSE_CAP_SPLICE_WRITE);
+#else
+	(void)conn;
+#endif
+
+	return NULL;
+}
+
 void afuse_destroy(void *p)
 {
 	(void)p;		/* Unused */
@@ -1587,13 +2525,12 @@ void afuse_destroy(void *p)
 static int afuse_setxattr(const char *path, const char *name, const char *value,
 			  size_t size, int flags)
 {
-	char *root_name = alloca(strlen(path));
-	char *real_path = alloca(max_path_out_len(path));
+	root_name_t root_name;
+	proxy_path_t real_path;
 	mount_list_t *mount;
 	int retval;
-	BLOCK_SIGALRM;
 
-	switch (process_path(path, real_path, root_name, 0, &mount)) {
+	switch (process_path(path, PATH_BUF, &real_path, &root_name, 0, &mount)) {
 	case PROC_PATH_FAILED:
 		retval = -ENXIO;
 		break;
@@ -1607,28 +2544,27 @@ static int afuse_setxattr(const char *path, const char *name, const char *value,
 		}
 	case PROC_PATH_PROXY_DIR:
 		retval =
-		    get_retval(lsetxattr(real_path, name, value, size, flags));
+		    get_retval(lsetxattr(real_path.path, name, value, size,
+					       flags));
+		invalidate_path(mount, path);
 		break;
 
 	default:
 		DEFAULT_CASE_INVALID_ENUM;
 	}
-	if (mount)
-		update_auto_unmount(mount);
-	UNBLOCK_SIGALRM;
+	put_path(&real_path, mount);
 	return retval;
 }
 
 static int afuse_getxattr(const char *path, const char *name, char *value,
 			  size_t size)
 {
-	char *root_name = alloca(strlen(path));
-	char *real_path = alloca(max_path_out_len(path));
+	root_name_t root_name;
+	proxy_path_t real_path;
 	mount_list_t *mount;
 	int retval;
-	BLOCK_SIGALRM;
 
-	switch (process_path(path, real_path, root_name, 1, &mount)) {
+	switch (process_path(path, PATH_BUF, &real_path, &root_name, 1, &mount)) {
 	case PROC_PATH_FAILED:
 		retval = -ENXIO;
 		break;
@@ -1641,27 +2577,25 @@ static int afuse_getxattr(const char *path, const char *name, char *value,
 			break;
 		}
 	case PROC_PATH_PROXY_DIR:
-		retval = get_retval(lgetxattr(real_path, name, value, size));
+		retval = get_retval(lgetxattr(real_path.path, name, value,
+					      size));
 		break;
 
 	default:
 		DEFAULT_CASE_INVALID_ENUM;
 	}
-	if (mount)
-		update_auto_unmount(mount);
-	UNBLOCK_SIGALRM;
+	put_path(&real_path, mount);
 	return retval;
 }
 
 static int afuse_listxattr(const char *path, char *list, size_t size)
 {
-	char *root_name = alloca(strlen(path));
-	char *real_path = alloca(max_path_out_len(path));
+	root_name_t root_name;
+	proxy_path_t real_path;
 	mount_list_t *mount;
 	int retval;
-	BLOCK_SIGALRM;
 
-	switch (process_path(path, real_path, root_name, 1, &mount)) {
+	switch (process_path(path, PATH_BUF, &real_path, &root_name, 1, &mount)) {
 	case PROC_PATH_FAILED:
 		retval = -ENXIO;
 		break;
@@ -1674,27 +2608,24 @@ static int afuse_listxattr(const char *path, char *list, size_t size)
 			break;
 		}
 	case PROC_PATH_PROXY_DIR:
-		retval = get_retval(llistxattr(real_path, list, size));
+		retval = get_retval(llistxattr(real_path.path, list, size));
 		break;
 
 	default:
 		DEFAULT_CASE_INVALID_ENUM;
 	}
-	if (mount)
-		update_auto_unmount(mount);
-	UNBLOCK_SIGALRM;
+	put_path(&real_path, mount);
 	return retval;
 }
 
 static int afuse_removexattr(const char *path, const char *name)
 {
-	char *root_name = alloca(strlen(path));
-	char *real_path = alloca(max_path_out_len(path));
+	root_name_t root_name;
+	proxy_path_t real_path;
 	mount_list_t *mount;
 	int retval;
-	BLOCK_SIGALRM;
 
-	switch (process_path(path, real_path, root_name, 0, &mount)) {
+	switch (process_path(path, PATH_BUF, &real_path, &root_name, 0, &mount)) {
 	case PROC_PATH_FAILED:
 		retval = -ENXIO;
 		break;
@@ -1707,15 +2638,14 @@ static int afuse_removexattr(const char *path, const char *name)
 			break;
 		}
 	case PROC_PATH_PROXY_DIR:
-		retval = get_retval(lremovexattr(real_path, name));
+		retval = get_retval(lremovexattr(real_path.path, name));
+		invalidate_path(mount, path);
 		break;
 
 	default:
 		DEFAULT_CASE_INVALID_ENUM;
 	}
-	if (mount)
-		update_auto_unmount(mount);
-	UNBLOCK_SIGALRM;
+	put_path(&real_path, mount);
 	return retval;
 }
 #endif				/* HAVE_SETXATTR */
@@ -1740,8 +2670,16 @@ static struct fuse_operations afuse_oper = {
 	.open = afuse_open,
 	.read = afuse_read,
 	.write = afuse_write,
+#if FUSE_VERSION >= 29
+	.read_buf = afuse_read_buf,
+	.write_buf = afuse_write_buf,
+#endif
+	.flush = afuse_flush,
 	.release = afuse_release,
 	.fsync = afuse_fsync,
+#if FUSE_VERSION >= 29
+	.fallocate = afuse_fallocate,
+#endif
 	.statfs = afuse_statfs,
 #if FUSE_VERSION >= 25
 	.access = afuse_access,
@@ -1749,6 +2687,7 @@ static struct fuse_operations afuse_oper = {
 	.ftruncate = afuse_ftruncate,
 	.fgetattr = afuse_fgetattr,
 #endif
+	.init = afuse_init,
 	.destroy = afuse_destroy,
 #ifdef HAVE_SETXATTR
 	.setxattr = afuse_setxattr,
@@ -1761,7 +2700,11 @@ static struct fuse_operations afuse_oper = {
 enum {
 	KEY_HELP,
 	KEY_FLUSHWRITES,
-	KEY_EXACT_GETATTR
+	KEY_EXACT_GETATTR,
+	KEY_SYMLINK_MOUNTS,
+	KEY_PREFETCH_ATTRS,
+	KEY_KEEP_CACHE,
+	KEY_ATTR_CACHE
 };
 
 #define AFUSE_OPT(t, p, v) { t, offsetof(struct user_options_t, p), v }
@@ -1770,13 +2713,25 @@ static struct fuse_opt afuse_opts[] = {
 	AFUSE_OPT("mount_template=%s", mount_command_template, 0),
 	AFUSE_OPT("unmount_template=%s", unmount_command_template, 0),
 	AFUSE_OPT("populate_root_command=%s", populate_root_command, 0),
+	AFUSE_OPT("populate_root_ttl=%u", populate_root_ttl, 0),
 	AFUSE_OPT("filter_file=%s", filter_file, 0),
 	AFUSE_OPT("mount_dir=%s", mount_dir, 0),
 
 	AFUSE_OPT("timeout=%llu", auto_unmount_delay, 0),
+	AFUSE_OPT("threads=%u", threads, 0),
+	AFUSE_OPT("flush_interval=%u", flush_interval, 0),
+	AFUSE_OPT("flush_bytes=%llu", flush_bytes, 0),
+	AFUSE_OPT("attr_cache_size=%u", attr_cache_size, 0),
+	AFUSE_OPT("attr_cache_ttl=%u", attr_cache_ttl, 0),
+	AFUSE_OPT("mount_backoff=%u", mount_backoff, 0),
+	AFUSE_OPT("mount_backoff_max=%u", mount_backoff_max, 0),
 
 	FUSE_OPT_KEY("exact_getattr", KEY_EXACT_GETATTR),
 	FUSE_OPT_KEY("flushwrites", KEY_FLUSHWRITES),
+	FUSE_OPT_KEY("symlink_mounts", KEY_SYMLINK_MOUNTS),
+	FUSE_OPT_KEY("prefetch_attrs", KEY_PREFETCH_ATTRS),
+	FUSE_OPT_KEY("attr_cache", KEY_ATTR_CACHE),
+	FUSE_OPT_KEY("keep_cache=", KEY_KEEP_CACHE),
 	FUSE_OPT_KEY("-h", KEY_HELP),
 	FUSE_OPT_KEY("--help", KEY_HELP),
 
@@ -1796,11 +2751,31 @@ static void usage(const char *progname)
 		"    -o mount_template=CMD         template for CMD to execute to mount (1)\n"
 		"    -o unmount_template=CMD       template for CMD to execute to unmount (1) (2)\n"
 		"    -o populate_root_command=CMD  CMD to execute providing root directory list (3)\n"
+		"    -o populate_root_ttl=SECS     reuse the output of populate_root_command for\n"
+		"                                  SECS seconds, rerunning it in the background (3)\n"
 		"    -o filter_file=FILE           FILE listing ignore filters for mount points (4)\n"
 		"    -o timeout=TIMEOUT            automatically unmount after TIMEOUT seconds\n"
 		"    -o flushwrites                flushes data to disk for all file writes\n"
+		"    -o flush_interval=MS          with flushwrites, sync within MS milliseconds\n"
+		"                                  of a write, 0 to sync every write (default: 100)\n"
+		"    -o flush_bytes=N              with flushwrites, sync once N bytes are unsynced\n"
+		"                                  (default: 8388608)\n"
+		"    -o mount_backoff=SECS         after a root fails to mount, fail accesses to it\n"
+		"                                  for SECS seconds, doubled on every failure (7)\n"
+		"    -o mount_backoff_max=SECS     with mount_backoff, the longest delay (default: 300)\n"
 		"    -o exact_getattr              allows getattr calls to cause a mount\n"
+		"    -o symlink_mounts             show mounted roots as symlinks to the real mounts (5)\n"
+		"    -o attr_cache                 cache the attributes of proxied files\n"
+		"    -o attr_cache_size=N          with attr_cache, cache at most N files\n"
+		"                                  (default: 65536)\n"
+		"    -o attr_cache_ttl=MS          with attr_cache, cache attributes for MS\n"
+		"                                  milliseconds (default: 1000)\n"
+		"    -o prefetch_attrs             have directory listings prefetch file attributes,\n"
+		"                                  implies attr_cache\n"
+		"    -o keep_cache=GLOB            keep the page cache of files opened under roots\n"
+		"                                  matching GLOB, may be repeated (6)\n"
 		"    -o mount_dir=DIR              place temporary mounts under DIR (default: /tmp)\n"
+		"    -o threads=N                  number of request threads (default: 10, -s for 1)\n"
 		"\n\n"
 		" (1) - When executed, %%r is expanded to the directory name inside the\n"
 		"       afuse mount, and %%m is expanded to the actual directory to mount\n"
@@ -1810,19 +2785,28 @@ static void usage(const char *progname)
 		"       -u -z options to fusermount, or -l for regular mount.\n"
 		"\n"
 		" (3) - The populate_root command should output one dir entry per line,\n"
-		"       and return immediately. It is run for each directory listing request.\n"
+		"       and return immediately. It is run for each directory listing request,\n"
+		"       unless populate_root_ttl is set.\n"
 		"\n"
 		" (4) - Each line of the filter file is a shell wildcard filter (glob). A '#'\n"
 		"       as the first character on a line ignores a filter.\n"
 		"\n"
+		" (5) - Accesses then bypass afuse. Following the symlink mounts the root and\n"
+		"       renews its lease, stat()ing it (ls -l) does neither. With -o timeout\n"
+		"       it is unmounted once not followed for TIMEOUT seconds, even if files\n"
+		"       under it are still open.\n"
+		"\n"
+		" (6) - The kernel caches of a root are invalidated once it is unmounted,\n"
+		"       which makes long FUSE entry_timeout, attr_timeout and\n"
+		"       negative_timeout options safe. These apply to every root.\n"
+		"\n"
+		" (7) - SIGUSR1 lists the roots that failed to mount and SIGUSR2 forgets\n"
+		"       them all. rmdir on a root that isn't mounted forgets its failures.\n"
+		"\n"
 		" The following filter patterns are hard-coded:"
 		"\n", progname);
 
-	mount_filter_list_t *cur = mount_filter_list;
-	while (cur) {
-		fprintf(stderr, "    %s\n", cur->pattern);
-		cur = cur->next;
-	}
+	mount_filter_print(stderr, "    ");
 
 	fprintf(stderr, "\n");
 }
@@ -1831,14 +2815,13 @@ static int afuse_opt_proc(void *data, const char *arg, int key,
 			  struct fuse_args *outargs)
 {
 	/* Unused */
-	(void)arg;
 	(void)data;
 
 	switch (key) {
 	case KEY_HELP:
 		usage(outargs->argv[0]);
 		fuse_opt_add_arg(outargs, "-ho");
-		fuse_main(outargs->argc, outargs->argv, &afuse_oper);
+		fuse_main(outargs->argc, outargs->argv, &afuse_oper, NULL);
 		exit(1);
 
 	case KEY_FLUSHWRITES:
@@ -1849,40 +2832,186 @@ static int afuse_opt_proc(void *data, const char *arg, int key,
 		user_options.exact_getattr = true;
 		return 0;
 
+	case KEY_SYMLINK_MOUNTS:
+		user_options.symlink_mounts = true;
+		return 0;
+
+	case KEY_PREFETCH_ATTRS:
+		user_options.prefetch_attrs = true;
+		user_options.attr_cache = true;
+		return 0;
+
+	case KEY_ATTR_CACHE:
+		user_options.attr_cache = true;
+		return 0;
+
+	case KEY_KEEP_CACHE:
+		add_keep_cache_glob(arg + strlen("keep_cache="));
+		return 0;
+
 	default:
 		return 1;
 	}
 }
 
+static pthread_mutex_t request_threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t request_threads_cond = PTHREAD_COND_INITIALIZER;
+static bool request_thread_exited = false;
+
+static void request_threads_done(void)
+{
+	pthread_mutex_lock(&request_threads_lock);
+	request_thread_exited = true;
+	pthread_cond_signal(&request_threads_cond);
+	pthread_mutex_unlock(&request_threads_lock);
+}
+
+static void *request_thread_main(void *arg)
+{
+	struct fuse_session *se = arg;
+	struct fuse_chan *ch = fuse_session_next_chan(se, NULL);
+	size_t bufsize = fuse_chan_bufsize(ch);
+	char *buf = my_malloc(bufsize);
+
+	pthread_cleanup_push(free, buf);
+	while (!fuse_session_exited(se)) {
+		struct fuse_chan *tmpch = ch;
+#if FUSE_VERSION >= 29
+		// Lets libfuse splice the request into a pipe, see
+		// afuse_write_buf()
+		struct fuse_buf fbuf = {
+			.mem = buf,
+			.size = bufsize,
+		};
+#endif
+		int res;
+
+		// Only allow cancellation while waiting for a request, never
+		// while one is being processed and locks may be held.
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+#if FUSE_VERSION >= 29
+		res = fuse_session_receive_buf(se, &fbuf, &tmpch);
+#else
+		res = fuse_chan_recv(&tmpch, buf, bufsize);
+#endif
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+		if (res == -EINTR)
+			continue;
+		if (res <= 0) {
+			if (res < 0)
+				fuse_session_exit(se);
+			break;
+		}
+
+#if FUSE_VERSION >= 29
+		fuse_session_process_buf(se, &fbuf, tmpch);
+#else
+		fuse_session_process(se, buf, res, tmpch);
+#endif
+	}
+	pthread_cleanup_pop(1);
+
+	request_threads_done();
+	return NULL;
+}
+
+// SIGINT, SIGTERM and SIGHUP handler, run on the event thread. The request
+// threads may be blocked reading /dev/fuse, run_request_threads() gets
+// them out.
+static void exit_signal(void *arg)
+{
+	fuse_session_exit(arg);
+	request_threads_done();
+}
+
+// SIGUSR1 handler with -o mount_backoff, run on the event thread
+static void print_mount_failures(void *arg)
+{
+	(void)arg;
+	fprintf(stderr, "Roots that failed to mount:\n");
+	mount_backoff_print(stderr, "\t", event_loop_now());
+}
+
+// SIGUSR2 handler with -o mount_backoff, run on the event thread
+static void reset_mount_failures(void *arg)
+{
+	(void)arg;
+	mount_backoff_reset_all();
+	fprintf(stderr, "Forgot the roots that failed to mount.\n");
+}
+
+// Serves FUSE requests on nthreads threads until the session exits or a
+// shutdown signal arrives. With nthreads == 1 requests are processed
+// strictly one at a time, like the single-threaded FUSE loop.
+static int run_request_threads(struct fuse_session *se, unsigned int nthreads)
+{
+	pthread_t *threads;
+	unsigned int i, started;
+	int err;
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	threads = my_malloc(nthreads * sizeof(*threads));
+	for (started = 0; started < nthreads; started++)
+		if ((err = pthread_create(&threads[started], NULL,
+					  request_thread_main, se)) != 0) {
+			fprintf(stderr,
+				"Failed to start request thread (%s)\n",
+				strerror(err));
+			break;
+		}
+	if (!started) {
+		free(threads);
+		return -1;
+	}
+
+	pthread_mutex_lock(&request_threads_lock);
+	while (!request_thread_exited)
+		pthread_cond_wait(&request_threads_cond, &request_threads_lock);
+	pthread_mutex_unlock(&request_threads_lock);
+
+	// The others may still be blocked waiting for a request
+	fuse_session_exit(se);
+	for (i = 0; i < started; i++) {
+		pthread_cancel(threads[i]);
+		pthread_join(threads[i], NULL);
+	}
+	free(threads);
+
+	fuse_session_reset(se);
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {
 	char *temp_dir_name;
 	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+	struct fuse *fuse;
+	char *mountpoint;
+	int multithreaded;
+	int res;
 
 	if (fuse_opt_parse(&args, &user_options, afuse_opts, afuse_opt_proc) ==
 	    -1)
 		return 1;
 
-	// !!FIXME!! force single-threading for now as data structures are not locked
-	fuse_opt_add_arg(&args, "-s");
-
 	// Adjust user specified timeout from seconds to microseconds as required
-	if (user_options.auto_unmount_delay != UINT64_MAX)
+	if (user_options.auto_unmount_delay != UINT64_MAX) {
 		user_options.auto_unmount_delay *= 1000000;
+		auto_unmount_delay_ticks = (user_options.auto_unmount_delay +
+					    AUTO_UNMOUNT_TICK -
+					    1) / AUTO_UNMOUNT_TICK;
+	}
 
-	auto_unmount_ph_init(&auto_unmount_ph);
+	if (user_options.threads == 0)
+		user_options.threads = 1;
 
-	/**
-	 * Install the SIGALRM signal handler.
-	 */
-	{
-		struct sigaction act;
-		act.sa_handler = &handle_auto_unmount_timer;
-		sigemptyset(&act.sa_mask);
-		act.sa_flags = 0;
-		while (sigaction(SIGALRM, &act, NULL) == -1 && errno == EINTR)
-			continue;
-	}
+	timer_wheel_init(&auto_unmount_wheel,
+			 event_loop_now() / AUTO_UNMOUNT_TICK);
+	attr_cache_init(user_options.attr_cache ? user_options.attr_cache_size :
+			0, (int64_t)user_options.attr_cache_ttl * 1000);
+	mount_backoff_init((int64_t)user_options.mount_backoff * 1000000,
+			   (int64_t)user_options.mount_backoff_max * 1000000);
 
 	if (!user_options.mount_dir) {
         size_t buflen = strlen(TMP_DIR_TEMPLATE);
@@ -1905,7 +3034,7 @@ int main(int argc, char *argv[])
 		fprintf(stderr, "(Un)Mount command templates missing.\n\n");
 		usage(argv[0]);
 		fuse_opt_add_arg(&args, "-ho");
-		fuse_main(args.argc, args.argv, &afuse_oper);
+		fuse_main(args.argc, args.argv, &afuse_oper, NULL);
 
 		return 1;
 	}
@@ -1918,6 +3047,11 @@ int main(int argc, char *argv[])
 			"Failed to create temporary mount point dir.\n");
 		return 1;
 	}
+	// As /proc/self/mountinfo lists mount points, see mountinfo_changed()
+	if ((temp_dir_name = realpath(mount_point_directory, NULL)))
+		mount_point_directory = temp_dir_name;
+	mount_point_directory_len = strlen(mount_point_directory);
+	pthread_key_create(&path_buffers_key, free_path_buffers);
 
 	{
 		struct stat buf;
@@ -1931,6 +3065,104 @@ int main(int argc, char *argv[])
 
 	umask(0);
 
-	// !!FIXME!! death by signal doesn't unmount fs
-	return fuse_main(args.argc, args.argv, &afuse_oper);
+	if (!(fuse = fuse_setup(args.argc, args.argv, &afuse_oper,
+				sizeof(afuse_oper), &mountpoint, &multithreaded,
+				NULL)))
+		return 1;
+
+	if (!multithreaded)
+		user_options.threads = 1;
+
+	/**
+	 * Everything asynchronous is handled by the event thread: the auto
+	 * unmount timer, the completion of the (un)mount commands, changes
+	 * to the mount table and the signals, which are blocked everywhere
+	 * else.
+	 */
+	if (event_loop_init() == -1 ||
+	    event_loop_add_signal(SIGINT, exit_signal,
+				  fuse_get_session(fuse)) == -1 ||
+	    event_loop_add_signal(SIGTERM, exit_signal,
+				  fuse_get_session(fuse)) == -1 ||
+	    event_loop_add_signal(SIGHUP, exit_signal,
+				  fuse_get_session(fuse)) == -1) {
+		perror("Failed to set up event loop");
+		fuse_teardown(fuse, mountpoint);
+		return 1;
+	}
+	event_loop_set_timer_handler(handle_auto_unmount_timer, NULL);
+
+	// Lets check_mount() skip the lstat() on every operation. Without it
+	// (not Linux), each operation checks its mount is still there.
+	if ((mountinfo_fd = open("/proc/self/mountinfo",
+				 O_RDONLY | O_CLOEXEC)) != -1 &&
+	    event_loop_add_priority_fd(mountinfo_fd, mountinfo_changed,
+				       NULL) == -1) {
+		close(mountinfo_fd);
+		mountinfo_fd = -1;
+	}
+	if (user_options.mount_backoff &&
+	    (event_loop_add_signal(SIGUSR1, print_mount_failures, NULL) == -1
+	     || event_loop_add_signal(SIGUSR2, reset_mount_failures,
+				      NULL) == -1)) {
+		perror("Failed to set up event loop");
+		fuse_teardown(fuse, mountpoint);
+		return 1;
+	}
+
+	{
+		sigset_t set, oldset;
+
+		sigfillset(&set);
+		pthread_sigmask(SIG_BLOCK, &set, &oldset);
+		res = pthread_create(&event_thread, NULL,
+				     event_thread_main, NULL);
+		pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+		if (res != 0) {
+			fprintf(stderr, "Failed to start event thread.\n");
+			fuse_teardown(fuse, mountpoint);
+			return 1;
+		}
+	}
+
+	if (user_options.flush_writes &&
+	    flusher_start((int64_t)user_options.flush_interval * 1000,
+			  user_options.flush_bytes) == -1) {
+		fuse_teardown(fuse, mountpoint);
+		return 1;
+	}
+
+	if (notifier_start(fuse_session_next_chan(fuse_get_session(fuse),
+						  NULL)) == -1) {
+		flusher_stop();
+		fuse_teardown(fuse, mountpoint);
+		return 1;
+	}
+
+	if (root_listing_start(user_options.populate_root_command,
+			       (int64_t)user_options.populate_root_ttl *
+			       1000000) == -1) {
+		notifier_stop();
+		flusher_stop();
+		fuse_teardown(fuse, mountpoint);
+		return 1;
+	}
+
+	res = run_request_threads(fuse_get_session(fuse),
+				  user_options.threads);
+
+	// No more writes, make the last ones durable before unmounting
+	flusher_stop();
+	// Pointless once the requests are no longer served
+	notifier_stop();
+	root_listing_stop();
+
+	// Unmounts everything through afuse_destroy(), which needs the
+	// event thread to reap the unmount commands.
+	fuse_teardown(fuse, mountpoint);
+
+	event_loop_stop();
+	pthread_join(event_thread, NULL);
+
+	return res == -1 ? 1 : 0;
 }
@@ -0,0 +1,180 @@
+#define __ATTR_CACHE_C
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "utils.h"
+#include "attr_cache.h"
+
+typedef struct _attr_entry_t {
+	struct _attr_entry_t *hash_next;
+	struct _attr_entry_t *lru_prev;	/* Towards the most recently used */
+	struct _attr_entry_t *lru_next;
+	uint64_t mount_id;
+	uint64_t generation;
+	uint32_t stamp;		/* Of the bucket when stored */
+	int64_t expires;
+	struct stat st;
+	uint32_t hash;
+	size_t len;
+	char path[];		/* Not NUL terminated */
+} attr_entry_t;
+
+static attr_entry_t **buckets = NULL;
+// Bumped on every invalidation, per bucket. Accessed atomically, the lock
+// is not needed to bump them.
+static uint32_t *stamps = NULL;
+static size_t bucket_count = 0;	/* Power of two */
+static attr_entry_t *lru_head = NULL;	/* Most recently used */
+static attr_entry_t *lru_tail = NULL;
+static size_t entry_count = 0;
+static size_t max_entry_count = 0;
+static int64_t entry_ttl = 0;
+static pthread_mutex_t attr_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void attr_cache_init(size_t max_entries, int64_t ttl)
+{
+	for (bucket_count = 1; bucket_count < max_entries;)
+		bucket_count *= 2;
+	buckets = my_malloc(bucket_count * sizeof(*buckets));
+	memset(buckets, 0, bucket_count * sizeof(*buckets));
+	stamps = my_malloc(bucket_count * sizeof(*stamps));
+	memset(stamps, 0, bucket_count * sizeof(*stamps));
+	max_entry_count = max_entries;
+	entry_ttl = ttl;
+}
+
+static attr_entry_t **find_entry(uint64_t mount_id, const char *path,
+				 size_t len, uint32_t hash)
+{
+	attr_entry_t **entry = &buckets[hash & (bucket_count - 1)];
+
+	for (; *entry; entry = &(*entry)->hash_next)
+		if ((*entry)->hash == hash && (*entry)->mount_id == mount_id
+		    && (*entry)->len == len && !memcmp((*entry)->path, path, len))
+			break;
+	return entry;
+}
+
+static void lru_unlink(attr_entry_t * entry)
+{
+	if (entry->lru_prev)
+		entry->lru_prev->lru_next = entry->lru_next;
+	else
+		lru_head = entry->lru_next;
+	if (entry->lru_next)
+		entry->lru_next->lru_prev = entry->lru_prev;
+	else
+		lru_tail = entry->lru_prev;
+}
+
+static void lru_push(attr_entry_t * entry)
+{
+	entry->lru_prev = NULL;
+	entry->lru_next = lru_head;
+	if (lru_head)
+		lru_head->lru_prev = entry;
+	else
+		lru_tail = entry;
+	lru_head = entry;
+}
+
+// link points to the entry, in its bucket.
+static void remove_entry(attr_entry_t ** link)
+{
+	attr_entry_t *entry = *link;
+
+	*link = entry->hash_next;
+	lru_unlink(entry);
+	entry_count--;
+	free(entry);
+}
+
+uint32_t attr_cache_stamp(uint32_t hash)
+{
+	if (!max_entry_count)
+		return 0;
+
+	return __atomic_load_n(&stamps[hash & (bucket_count - 1)],
+			       __ATOMIC_ACQUIRE);
+}
+
+void attr_cache_put(uint64_t mount_id, uint64_t generation, uint32_t stamp,
+		    const char *path, size_t len, uint32_t hash,
+		    const struct stat *st, int64_t now)
+{
+	attr_entry_t **link, *entry;
+
+	if (!max_entry_count || (!S_ISDIR(st->st_mode) && st->st_nlink > 1))
+		return;
+
+	pthread_mutex_lock(&attr_cache_lock);
+	if (attr_cache_stamp(hash) != stamp) {
+		pthread_mutex_unlock(&attr_cache_lock);
+		return;
+	}
+	link = find_entry(mount_id, path, len, hash);
+	if ((entry = *link))
+		lru_unlink(entry);
+	else {
+		if (entry_count == max_entry_count) {
+			remove_entry(find_entry(lru_tail->mount_id,
+						lru_tail->path, lru_tail->len,
+						lru_tail->hash));
+			/* May have been the predecessor in our bucket */
+			link = find_entry(mount_id, path, len, hash);
+		}
+		entry = my_malloc(sizeof(attr_entry_t) + len);
+		entry->mount_id = mount_id;
+		entry->hash = hash;
+		entry->len = len;
+		memcpy(entry->path, path, len);
+		entry->hash_next = NULL;
+		*link = entry;
+		entry_count++;
+	}
+	entry->generation = generation;
+	// An invalidation from now on bumps the stamp past this one
+	entry->stamp = stamp;
+	entry->expires = now + entry_ttl;
+	entry->st = *st;
+	lru_push(entry);
+	pthread_mutex_unlock(&attr_cache_lock);
+}
+
+bool attr_cache_get(uint64_t mount_id, uint64_t generation, const char *path,
+		    size_t len, uint32_t hash, struct stat *st, int64_t now)
+{
+	attr_entry_t **link, *entry;
+	bool found = false;
+
+	if (!max_entry_count)
+		return false;
+
+	pthread_mutex_lock(&attr_cache_lock);
+	link = find_entry(mount_id, path, len, hash);
+	if ((entry = *link)) {
+		if (entry->generation != generation || entry->expires <= now ||
+		    entry->stamp != attr_cache_stamp(hash))
+			remove_entry(link);
+		else {
+			*st = entry->st;
+			lru_unlink(entry);
+			lru_push(entry);
+			found = true;
+		}
+	}
+	pthread_mutex_unlock(&attr_cache_lock);
+
+	return found;
+}
+
+// Entries of the bucket are left to attr_cache_get() and the LRU to free
+void attr_cache_invalidate(uint32_t hash)
+{
+	if (!max_entry_count)
+		return;
+
+	__atomic_fetch_add(&stamps[hash & (bucket_count - 1)], 1,
+			   __ATOMIC_RELEASE);
+}
@@ -0,0 +1,48 @@
+#ifndef __ATTR_CACHE_H
+#define __ATTR_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+// Attributes of proxied files, keyed by mount and path, so getattr can skip
+// the round trip to the proxied filesystem. Entries expire after a fixed
+// time and the least recently used ones are evicted once the cache is full.
+// An entry is only returned for the generation it was stored with, so a
+// mount invalidates all of its entries by bumping its generation, while
+// attr_cache_invalidate() invalidates a single path. Can be used from any
+// thread.
+//
+// Attributes looked up while a path is being changed must not be stored
+// afterwards, so callers take a stamp with attr_cache_stamp() before the
+// lookup and hand it to attr_cache_put(), which drops the attributes if
+// the path may have been invalidated in between.
+
+#undef EXTERN
+#ifdef __ATTR_CACHE_C
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+// Must be called before any other function. ttl is in the unit of the now
+// arguments below.
+EXTERN void attr_cache_init(size_t max_entries, int64_t ttl);
+// hash is the str_hash() of the path.
+EXTERN uint32_t attr_cache_stamp(uint32_t hash);
+// hash must be str_hash() of the len bytes at path, which need not be NUL
+// terminated. The attributes of files with several links are not stored,
+// as changing them through one name would leave the others stale.
+EXTERN void attr_cache_put(uint64_t mount_id, uint64_t generation,
+			   uint32_t stamp, const char *path, size_t len,
+			   uint32_t hash, const struct stat *st, int64_t now);
+// Returns false if there is no unexpired entry for the path.
+EXTERN bool attr_cache_get(uint64_t mount_id, uint64_t generation,
+			   const char *path, size_t len, uint32_t hash,
+			   struct stat *st, int64_t now);
+// Invalidates every path with that hash, on any mount, without taking the
+// cache's lock: it is called for every write.
+EXTERN void attr_cache_invalidate(uint32_t hash);
+
+#endif				// __ATTR_CACHE_H
@@ -0,0 +1,197 @@
+#define __DIR_STREAM_C
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#ifdef HAVE_SYS_SYSCALL_H
+#include <sys/syscall.h>
+#endif
+#include "utils.h"
+#include "dir_stream.h"
+
+#if defined(__linux__) && defined(SYS_getdents64)
+#define USE_GETDENTS64
+#endif
+
+#ifdef USE_GETDENTS64
+// A couple of the kernel's page sized readdir requests, or about a hundred
+// entries. Only allocated while the directory is being read, as programs
+// like find keep many directories open.
+#define DIR_STREAM_BUF_SIZE 8192
+
+// As returned by getdents64(), which glibc only wraps since 2.30
+struct linux_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+struct _dir_stream_t {
+	int fd;
+	off_t offset;		/* Cookie of the entry at pos */
+	size_t pos;		/* Next entry in buf */
+	size_t end;		/* End of the entries in buf */
+	dir_entry_t entry;
+	char *buf;		/* NULL unless entries are being read */
+};
+
+dir_stream_t *dir_stream_open(int fd)
+{
+	dir_stream_t *stream = my_malloc(sizeof(dir_stream_t));
+
+	stream->fd = fd;
+	stream->offset = 0;
+	stream->pos = 0;
+	stream->end = 0;
+	stream->buf = NULL;
+	return stream;
+}
+
+int dir_stream_close(dir_stream_t * stream)
+{
+	int res = close(stream->fd);
+
+	free(stream->buf);
+	free(stream);
+	return res;
+}
+
+int dir_stream_fd(dir_stream_t * stream)
+{
+	return stream->fd;
+}
+
+int dir_stream_seek(dir_stream_t * stream, off_t offset)
+{
+	// Continuing from where the last call stopped, the common case
+	if (offset == stream->offset)
+		return 0;
+
+	if (lseek(stream->fd, offset, SEEK_SET) == -1)
+		return -errno;
+	stream->offset = offset;
+	stream->pos = 0;
+	stream->end = 0;
+	return 0;
+}
+
+const dir_entry_t *dir_stream_peek(dir_stream_t * stream)
+{
+	struct linux_dirent64 *de;
+	long res;
+
+	if (stream->pos == stream->end) {
+		if (!stream->buf)
+			stream->buf = my_malloc(DIR_STREAM_BUF_SIZE);
+		res = syscall(SYS_getdents64, stream->fd, stream->buf,
+			      DIR_STREAM_BUF_SIZE);
+		if (res <= 0) {
+			if (res == 0)
+				errno = 0;
+			// Back once the directory is read again
+			free(stream->buf);
+			stream->buf = NULL;
+			stream->pos = 0;
+			stream->end = 0;
+			return NULL;
+		}
+		stream->pos = 0;
+		stream->end = res;
+	}
+
+	de = (struct linux_dirent64 *)(stream->buf + stream->pos);
+	stream->entry.ino = de->d_ino;
+	stream->entry.type = de->d_type;
+	stream->entry.next = de->d_off;
+	stream->entry.name = de->d_name;
+	return &stream->entry;
+}
+
+void dir_stream_next(dir_stream_t * stream)
+{
+	struct linux_dirent64 *de =
+	    (struct linux_dirent64 *)(stream->buf + stream->pos);
+
+	stream->pos += de->d_reclen;
+	stream->offset = de->d_off;
+}
+
+#else				/* !USE_GETDENTS64 */
+
+struct _dir_stream_t {
+	DIR *dir;
+	off_t offset;		/* Cookie of the entry at the current position */
+	bool peeked;		/* entry holds the entry at offset */
+	dir_entry_t entry;
+};
+
+dir_stream_t *dir_stream_open(int fd)
+{
+	dir_stream_t *stream;
+	DIR *dir = fdopendir(fd);
+
+	if (!dir)
+		return NULL;
+	stream = my_malloc(sizeof(dir_stream_t));
+	stream->dir = dir;
+	stream->offset = 0;
+	stream->peeked = false;
+	return stream;
+}
+
+int dir_stream_close(dir_stream_t * stream)
+{
+	int res = closedir(stream->dir);
+
+	free(stream);
+	return res;
+}
+
+int dir_stream_fd(dir_stream_t * stream)
+{
+	return dirfd(stream->dir);
+}
+
+int dir_stream_seek(dir_stream_t * stream, off_t offset)
+{
+	if (offset == stream->offset)
+		return 0;
+
+	seekdir(stream->dir, offset);
+	stream->offset = offset;
+	stream->peeked = false;
+	return 0;
+}
+
+const dir_entry_t *dir_stream_peek(dir_stream_t * stream)
+{
+	struct dirent *de;
+
+	if (stream->peeked)
+		return &stream->entry;
+
+	errno = 0;
+	if (!(de = readdir(stream->dir)))
+		return NULL;
+	stream->entry.ino = de->d_ino;
+	stream->entry.type = de->d_type;
+	stream->entry.next = telldir(stream->dir);
+	stream->entry.name = de->d_name;
+	stream->peeked = true;
+	return &stream->entry;
+}
+
+void dir_stream_next(dir_stream_t * stream)
+{
+	stream->offset = stream->entry.next;
+	stream->peeked = false;
+}
+
+#endif				/* USE_GETDENTS64 */
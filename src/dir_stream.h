@@ -0,0 +1,43 @@
+#ifndef __DIR_STREAM_H
+#define __DIR_STREAM_H
+
+#include <sys/types.h>
+
+// Directory stream for proxied directories. On Linux entries are read with
+// getdents64() in batches and identified by the kernel's offset cookies,
+// so reading on from where the previous call stopped is served from the
+// buffer rather than seeking and reading again. Elsewhere it wraps a DIR.
+
+typedef struct _dir_stream_t dir_stream_t;
+
+typedef struct _dir_entry_t {
+	ino_t ino;
+	unsigned char type;	/* DT_* */
+	off_t next;		/* Cookie of the following entry */
+	const char *name;
+} dir_entry_t;
+
+#undef EXTERN
+#ifdef __DIR_STREAM_C
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+// Takes ownership of fd, an open directory. Returns NULL with errno set on
+// failure, in which case fd is left open.
+EXTERN dir_stream_t *dir_stream_open(int fd);
+// Frees the stream whatever the outcome of closing the directory.
+EXTERN int dir_stream_close(dir_stream_t * stream);
+EXTERN int dir_stream_fd(dir_stream_t * stream);
+// Positions the stream before the entry with cookie offset, 0 being the
+// first entry. Returns 0 or -errno.
+EXTERN int dir_stream_seek(dir_stream_t * stream, off_t offset);
+// Returns the entry at the current position, without moving past it, or
+// NULL at the end of the directory or on error (with errno set). Valid
+// until the next call on the stream.
+EXTERN const dir_entry_t *dir_stream_peek(dir_stream_t * stream);
+// Moves past the entry returned by dir_stream_peek().
+EXTERN void dir_stream_next(dir_stream_t * stream);
+
+#endif				// __DIR_STREAM_H
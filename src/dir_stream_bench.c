@@ -0,0 +1,128 @@
+// Time to list a directory through dir_stream the way afuse_readdir() does,
+// against seekdir()/readdir() as it did before: every call picks up at the
+// offset the previous one stopped at and returns as many entries as fit in
+// one of the kernel's page sized readdir requests. DIR is filled with COUNT
+// empty files first if it does not exist.
+//
+//   make dir_stream_bench
+//   ./dir_stream_bench DIR 1000000
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "event_loop.h"
+#include "dir_stream.h"
+
+// Short names take 32 bytes in a 4 KiB readdir request
+#define ENTRIES_PER_CALL 128
+
+static int fill(const char *path, long count)
+{
+	char name[32];
+	long i;
+	int dirfd, fd;
+
+	if (mkdir(path, 0700) == -1)
+		return errno == EEXIST ? 0 : -1;
+	if ((dirfd = open(path, O_RDONLY | O_DIRECTORY)) == -1)
+		return -1;
+	for (i = 0; i < count; i++) {
+		snprintf(name, sizeof(name), "%ld", i);
+		if ((fd = openat(dirfd, name, O_WRONLY | O_CREAT, 0600)) == -1)
+			return -1;
+		close(fd);
+	}
+	close(dirfd);
+	return 0;
+}
+
+static long list_stream(const char *path, long *calls)
+{
+	const dir_entry_t *entry;
+	dir_stream_t *stream;
+	off_t offset = 0;
+	long count = 0, got;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY | O_DIRECTORY)) == -1 ||
+	    !(stream = dir_stream_open(fd)))
+		return -1;
+	*calls = 0;
+	do {
+		(*calls)++;
+		if (dir_stream_seek(stream, offset))
+			return -1;
+		for (got = 0; got < ENTRIES_PER_CALL &&
+		     (entry = dir_stream_peek(stream)); got++) {
+			offset = entry->next;
+			dir_stream_next(stream);
+		}
+		count += got;
+	} while (got);
+	if (errno) {
+		dir_stream_close(stream);
+		return -1;
+	}
+	dir_stream_close(stream);
+
+	return count;
+}
+
+static long list_seekdir(const char *path)
+{
+	struct dirent *de;
+	DIR *dp;
+	long offset = 0, count = 0, got;
+
+	if (!(dp = opendir(path)))
+		return -1;
+	do {
+		seekdir(dp, offset);
+		for (got = 0; got < ENTRIES_PER_CALL && (de = readdir(dp));
+		     got++)
+			offset = telldir(dp);
+		count += got;
+	} while (got);
+	closedir(dp);
+
+	return count;
+}
+
+int main(int argc, char **argv)
+{
+	int64_t start, stream_time, seekdir_time;
+	long stream_count, seekdir_count, calls;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s DIR [COUNT]\n", argv[0]);
+		return 1;
+	}
+	if (fill(argv[1], argc > 2 ? atol(argv[2]) : 100000) == -1) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	start = event_loop_now();
+	stream_count = list_stream(argv[1], &calls);
+	stream_time = event_loop_now() - start;
+
+	start = event_loop_now();
+	seekdir_count = list_seekdir(argv[1]);
+	seekdir_time = event_loop_now() - start;
+
+	if (stream_count == -1 || seekdir_count == -1) {
+		perror(argv[1]);
+		return 1;
+	}
+	printf("%ld entries in %ld calls: dir_stream %.3f s, "
+	       "seekdir %.3f s (%ld entries)\n", stream_count, calls,
+	       stream_time / 1e6, seekdir_time / 1e6, seekdir_count);
+	return 0;
+}
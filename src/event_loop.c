@@ -0,0 +1,579 @@
+#define __EVENT_LOOP_C
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+#ifdef HAVE_SYS_TIMERFD_H
+#include <sys/timerfd.h>
+#endif
+#ifdef HAVE_SYS_SIGNALFD_H
+#include <sys/signalfd.h>
+#endif
+#ifdef HAVE_SYS_PIDFD_H
+#include <sys/pidfd.h>
+#endif
+#ifdef HAVE_SYS_SYSCALL_H
+#include <sys/syscall.h>
+#endif
+#include "utils.h"
+#include "event_loop.h"
+
+// On Linux the loop is an epoll set over a timerfd, a signalfd and one
+// pidfd per child. Without those (or on kernels lacking pidfd) it degrades
+// to poll() with a poll timeout for the timer, a self-pipe for signals and
+// SIGCHLD + waitpid() for children.
+
+typedef struct _event_source_t {
+	struct _event_source_t *next;
+
+	int fd;			// -1 for children reaped on SIGCHLD
+	short events;		// POLLIN or POLLPRI
+	pid_t pid;		// -1 unless the source is a child
+	event_handler_t handler;
+	child_handler_t child_handler;
+	void *arg;
+} event_source_t;
+
+// Guards sources, stopping and timer_deadline. Sources are only ever freed
+// by the loop thread, so it can use them unlocked once they are found.
+static pthread_mutex_t event_lock = PTHREAD_MUTEX_INITIALIZER;
+static event_source_t *sources = NULL;
+static bool stopping = false;
+static int wake_pipe[2] = { -1, -1 };
+
+static event_handler_t timer_handler = NULL;
+static void *timer_arg = NULL;
+#ifdef HAVE_SYS_TIMERFD_H
+static int timer_fd = -1;
+#else
+static int64_t timer_deadline = INT64_MAX;
+#endif
+
+static struct {
+	event_handler_t handler;
+	void *arg;
+} signal_handlers[NSIG];
+static sigset_t signal_set;
+#ifdef HAVE_SYS_SIGNALFD_H
+static int signal_fd = -1;
+#else
+static int signal_pipe[2] = { -1, -1 };
+#endif
+
+#ifdef HAVE_SYS_EPOLL_H
+static int epoll_fd = -1;
+#endif
+
+static int set_nonblock_cloexec(int fd)
+{
+	int flags;
+
+	if ((flags = fcntl(fd, F_GETFL)) == -1 ||
+	    fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1 ||
+	    fcntl(fd, F_SETFD, FD_CLOEXEC) == -1)
+		return -1;
+	return 0;
+}
+
+static void wake(void)
+{
+	char c = 0;
+
+	if (write(wake_pipe[1], &c, 1) == -1 && errno != EAGAIN)
+		perror("Failed to wake event loop");
+}
+
+static int open_pidfd(pid_t pid)
+{
+#if defined(HAVE_PIDFD_OPEN) && defined(HAVE_SYS_PIDFD_H)
+	return pidfd_open(pid, 0);
+#elif defined(SYS_pidfd_open)
+	return syscall(SYS_pidfd_open, pid, 0);
+#else
+	(void)pid;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+// Must be called with event_lock held.
+static int add_source(event_source_t * src)
+{
+#ifdef HAVE_SYS_EPOLL_H
+	if (src->fd != -1) {
+		struct epoll_event ev;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = src->events == POLLPRI ? EPOLLPRI : EPOLLIN;
+		ev.data.ptr = src;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, src->fd, &ev) == -1)
+			return -1;
+	}
+#endif
+	src->next = sources;
+	sources = src;
+	return 0;
+}
+
+// Must be called with event_lock held.
+static void unlink_source(event_source_t * src)
+{
+	event_source_t **srcp;
+
+	for (srcp = &sources; *srcp; srcp = &(*srcp)->next)
+		if (*srcp == src) {
+			*srcp = src->next;
+			break;
+		}
+#ifdef HAVE_SYS_EPOLL_H
+	if (src->fd != -1)
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, src->fd, NULL);
+#endif
+}
+
+// Returns the wait status of the child, or -1 if it could not be
+// retrieved. Only called once the child is known to have exited.
+static int wait_child(pid_t pid)
+{
+	int status;
+
+	while (waitpid(pid, &status, 0) == -1)
+		if (errno != EINTR)
+			return -1;
+	return status;
+}
+
+static void child_ready(event_source_t * src)
+{
+	int status = wait_child(src->pid);
+
+	pthread_mutex_lock(&event_lock);
+	unlink_source(src);
+	pthread_mutex_unlock(&event_lock);
+
+	close(src->fd);
+	src->child_handler(src->arg, status);
+	free(src);
+}
+
+// SIGCHLD handler, for the children we could not get a pidfd for.
+static void reap_children(void *arg)
+{
+	event_source_t *src, **srcp, *exited = NULL;
+	int status;
+	pid_t pid;
+
+	(void)arg;
+	pthread_mutex_lock(&event_lock);
+	for (srcp = &sources; (src = *srcp);) {
+		if (src->fd != -1 || src->pid == -1) {
+			srcp = &src->next;
+			continue;
+		}
+
+		pid = waitpid(src->pid, &status, WNOHANG);
+		if (pid == 0 || (pid == -1 && errno == EINTR)) {
+			srcp = &src->next;
+			continue;
+		}
+		if (pid == -1)
+			status = -1;
+
+		*srcp = src->next;
+		// Stash the status in the now unused fd field
+		src->fd = status;
+		src->next = exited;
+		exited = src;
+	}
+	pthread_mutex_unlock(&event_lock);
+
+	while ((src = exited)) {
+		exited = src->next;
+		src->child_handler(src->arg, src->fd);
+		free(src);
+	}
+}
+
+static void wake_ready(void *arg)
+{
+	char buf[64];
+
+	(void)arg;
+	while (read(wake_pipe[0], buf, sizeof(buf)) > 0) ;
+
+	// A child without a pidfd may have exited before it was added
+	reap_children(NULL);
+}
+
+#ifndef HAVE_SYS_SIGNALFD_H
+static void signal_pipe_writer(int signo)
+{
+	int saved_errno = errno;
+	unsigned char c = signo;
+
+	if (write(signal_pipe[1], &c, 1) == -1) {
+		/* Nothing sensible to do from a signal handler */
+	}
+	errno = saved_errno;
+}
+#endif
+
+static void signal_ready(void *arg)
+{
+	int signo;
+
+	(void)arg;
+	for (;;) {
+#ifdef HAVE_SYS_SIGNALFD_H
+		struct signalfd_siginfo si;
+
+		if (read(signal_fd, &si, sizeof(si)) != sizeof(si))
+			break;
+		signo = si.ssi_signo;
+#else
+		unsigned char c;
+
+		if (read(signal_pipe[0], &c, 1) != 1)
+			break;
+		signo = c;
+#endif
+		if (signo > 0 && signo < NSIG && signal_handlers[signo].handler)
+			signal_handlers[signo].handler(signal_handlers[signo].
+						       arg);
+	}
+}
+
+#ifdef HAVE_SYS_TIMERFD_H
+static void timer_ready(void *arg)
+{
+	uint64_t expirations;
+
+	(void)arg;
+	if (read(timer_fd, &expirations, sizeof(expirations)) !=
+	    sizeof(expirations))
+		return;
+	if (timer_handler)
+		timer_handler(timer_arg);
+}
+
+static int poll_timeout(void)
+{
+	return -1;
+}
+
+static void check_timer(void)
+{
+}
+#else
+static int poll_timeout(void)
+{
+	int64_t deadline, now;
+
+	pthread_mutex_lock(&event_lock);
+	deadline = timer_deadline;
+	pthread_mutex_unlock(&event_lock);
+
+	if (deadline == INT64_MAX)
+		return -1;
+	now = event_loop_now();
+	if (deadline <= now)
+		return 0;
+	if (deadline - now > (int64_t) 1000 * 1000 * 1000)
+		return 1000 * 1000;
+	/* Round up so we don't wake up just before the deadline */
+	return (deadline - now + 999) / 1000;
+}
+
+static void check_timer(void)
+{
+	bool expired;
+
+	pthread_mutex_lock(&event_lock);
+	expired = timer_deadline <= event_loop_now();
+	if (expired)
+		timer_deadline = INT64_MAX;
+	pthread_mutex_unlock(&event_lock);
+
+	if (expired && timer_handler)
+		timer_handler(timer_arg);
+}
+#endif
+
+static void dispatch(event_source_t * src)
+{
+	if (src->pid != -1)
+		child_ready(src);
+	else
+		src->handler(src->arg);
+}
+
+int event_loop_init(void)
+{
+	sigemptyset(&signal_set);
+
+	if (pipe(wake_pipe) == -1 || set_nonblock_cloexec(wake_pipe[0]) ||
+	    set_nonblock_cloexec(wake_pipe[1]))
+		return -1;
+#ifdef HAVE_SYS_EPOLL_H
+	if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+		return -1;
+#endif
+	if (event_loop_add_fd(wake_pipe[0], wake_ready, NULL) == -1)
+		return -1;
+
+#ifdef HAVE_SYS_TIMERFD_H
+	if ((timer_fd = timerfd_create(CLOCK_MONOTONIC,
+				       TFD_NONBLOCK | TFD_CLOEXEC)) == -1 ||
+	    event_loop_add_fd(timer_fd, timer_ready, NULL) == -1)
+		return -1;
+#endif
+
+#ifdef HAVE_SYS_SIGNALFD_H
+	if ((signal_fd = signalfd(-1, &signal_set,
+				  SFD_NONBLOCK | SFD_CLOEXEC)) == -1 ||
+	    event_loop_add_fd(signal_fd, signal_ready, NULL) == -1)
+		return -1;
+#else
+	if (pipe(signal_pipe) == -1 || set_nonblock_cloexec(signal_pipe[0]) ||
+	    set_nonblock_cloexec(signal_pipe[1]) ||
+	    event_loop_add_fd(signal_pipe[0], signal_ready, NULL) == -1)
+		return -1;
+#endif
+
+	return event_loop_add_signal(SIGCHLD, reap_children, NULL);
+}
+
+void event_loop_run(void)
+{
+	event_source_t **ready = NULL;
+	size_t ready_size = 0;
+#ifdef HAVE_SYS_EPOLL_H
+	struct epoll_event events[16];
+#else
+	struct pollfd *fds = NULL;
+	event_source_t *src;
+#endif
+	int i, n;
+
+#ifndef HAVE_SYS_SIGNALFD_H
+	// Signals are blocked everywhere else, see event_loop_add_signal()
+	pthread_sigmask(SIG_UNBLOCK, &signal_set, NULL);
+#endif
+
+	for (;;) {
+		pthread_mutex_lock(&event_lock);
+		if (stopping) {
+			pthread_mutex_unlock(&event_lock);
+			break;
+		}
+#ifdef HAVE_SYS_EPOLL_H
+		pthread_mutex_unlock(&event_lock);
+
+		n = epoll_wait(epoll_fd, events,
+			       sizeof(events) / sizeof(events[0]),
+			       poll_timeout());
+		if (n > 0 && (size_t)n > ready_size) {
+			ready_size = n;
+			ready = my_realloc(ready, ready_size * sizeof(*ready));
+		}
+		for (i = 0; i < n; i++)
+			ready[i] = events[i].data.ptr;
+#else
+		for (n = 0, src = sources; src; src = src->next)
+			if (src->fd != -1)
+				n++;
+		if ((size_t)n > ready_size) {
+			ready_size = n;
+			ready = my_realloc(ready, ready_size * sizeof(*ready));
+			fds = my_realloc(fds, ready_size * sizeof(*fds));
+		}
+		for (n = 0, src = sources; src; src = src->next)
+			if (src->fd != -1) {
+				ready[n] = src;
+				fds[n].fd = src->fd;
+				fds[n].events = src->events;
+				fds[n++].revents = 0;
+			}
+		pthread_mutex_unlock(&event_lock);
+
+		if (poll(fds, n, poll_timeout()) > 0) {
+			int m = 0;
+
+			for (i = 0; i < n; i++)
+				if (fds[i].revents)
+					ready[m++] = ready[i];
+			n = m;
+		} else
+			n = 0;
+#endif
+		if (n == -1 && errno != EINTR) {
+			perror("Event loop failed");
+			break;
+		}
+
+		for (i = 0; i < n; i++)
+			dispatch(ready[i]);
+		check_timer();
+	}
+
+	free(ready);
+#ifndef HAVE_SYS_EPOLL_H
+	free(fds);
+#endif
+}
+
+void event_loop_stop(void)
+{
+	pthread_mutex_lock(&event_lock);
+	stopping = true;
+	pthread_mutex_unlock(&event_lock);
+	wake();
+}
+
+static int add_fd(int fd, short events, event_handler_t handler, void *arg)
+{
+	event_source_t *src;
+	int ret;
+
+	src = my_malloc(sizeof(event_source_t));
+	src->fd = fd;
+	src->events = events;
+	src->pid = -1;
+	src->handler = handler;
+	src->child_handler = NULL;
+	src->arg = arg;
+
+	pthread_mutex_lock(&event_lock);
+	ret = add_source(src);
+	pthread_mutex_unlock(&event_lock);
+	if (ret == -1) {
+		free(src);
+		return -1;
+	}
+
+	// poll() needs to pick up the new fd
+	if (wake_pipe[1] != -1)
+		wake();
+	return 0;
+}
+
+int event_loop_add_fd(int fd, event_handler_t handler, void *arg)
+{
+	return add_fd(fd, POLLIN, handler, arg);
+}
+
+int event_loop_add_priority_fd(int fd, event_handler_t handler, void *arg)
+{
+	return add_fd(fd, POLLPRI, handler, arg);
+}
+
+int event_loop_add_signal(int signo, event_handler_t handler, void *arg)
+{
+	sigset_t set;
+
+	signal_handlers[signo].handler = handler;
+	signal_handlers[signo].arg = arg;
+	sigaddset(&signal_set, signo);
+
+	sigemptyset(&set);
+	sigaddset(&set, signo);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+#ifdef HAVE_SYS_SIGNALFD_H
+	if (signalfd(signal_fd, &signal_set, 0) == -1)
+		return -1;
+#else
+	{
+		struct sigaction act;
+
+		act.sa_handler = signal_pipe_writer;
+		sigemptyset(&act.sa_mask);
+		act.sa_flags = SA_RESTART;
+		if (sigaction(signo, &act, NULL) == -1)
+			return -1;
+	}
+#endif
+	return 0;
+}
+
+int event_loop_add_child(pid_t pid, child_handler_t handler, void *arg)
+{
+	event_source_t *src;
+	int fd, ret;
+
+	src = my_malloc(sizeof(event_source_t));
+	src->fd = fd = open_pidfd(pid);
+	src->events = POLLIN;
+	src->pid = pid;
+	src->handler = NULL;
+	src->child_handler = handler;
+	src->arg = arg;
+
+	pthread_mutex_lock(&event_lock);
+	if ((ret = add_source(src)) == -1 && fd != -1) {
+		close(fd);
+		src->fd = fd = -1;
+		ret = add_source(src);
+	}
+	pthread_mutex_unlock(&event_lock);
+	if (ret == -1) {
+		free(src);
+		return -1;
+	}
+
+	// Without a pidfd its SIGCHLD may already have been handled, and
+	// poll() needs to pick up a new pidfd.
+	wake();
+	return 0;
+}
+
+int64_t event_loop_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void event_loop_set_timer_handler(event_handler_t handler, void *arg)
+{
+	timer_handler = handler;
+	timer_arg = arg;
+}
+
+void event_loop_arm_timer(int64_t deadline)
+{
+#ifdef HAVE_SYS_TIMERFD_H
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	if (deadline != INT64_MAX) {
+		/* A zero it_value would disarm the timer */
+		if (deadline <= 0)
+			deadline = 1;
+		its.it_value.tv_sec = deadline / 1000000;
+		its.it_value.tv_nsec = (deadline % 1000000) * 1000;
+	}
+	if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL) == -1)
+		perror("Error setting timer");
+#else
+	pthread_mutex_lock(&event_lock);
+	timer_deadline = deadline;
+	pthread_mutex_unlock(&event_lock);
+	wake();
+#endif
+}
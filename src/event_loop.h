@@ -0,0 +1,49 @@
+#ifndef __EVENT_LOOP_H
+#define __EVENT_LOOP_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// Single threaded event loop multiplexing file descriptors, signals, one
+// timer and the completion of child processes. Handlers run on the thread
+// calling event_loop_run().
+
+typedef void (*event_handler_t) (void *arg);
+typedef void (*child_handler_t) (void *arg, int status);
+
+#undef EXTERN
+#ifdef __EVENT_LOOP_C
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+// Must be called before any other thread is started.
+EXTERN int event_loop_init(void);
+// Runs handlers until event_loop_stop() is called.
+EXTERN void event_loop_run(void);
+EXTERN void event_loop_stop(void);
+
+// handler is called whenever fd is readable.
+EXTERN int event_loop_add_fd(int fd, event_handler_t handler, void *arg);
+// handler is called whenever fd reports an exceptional condition (POLLPRI),
+// such as /proc/self/mountinfo does when the mount table changes.
+EXTERN int event_loop_add_priority_fd(int fd, event_handler_t handler,
+				      void *arg);
+// Blocks signo in the calling thread and has handler called for it
+// instead. Must be called before any other thread is started.
+EXTERN int event_loop_add_signal(int signo, event_handler_t handler,
+				 void *arg);
+// Reaps pid once it exits and calls handler with its wait status (-1 if
+// it could not be retrieved). Can be called from any thread.
+EXTERN int event_loop_add_child(pid_t pid, child_handler_t handler,
+				void *arg);
+
+// Monotonic clock, in microseconds.
+EXTERN int64_t event_loop_now(void);
+// handler is called once event_loop_now() reaches deadline. INT64_MAX
+// disarms the timer. Can be called from any thread.
+EXTERN void event_loop_set_timer_handler(event_handler_t handler, void *arg);
+EXTERN void event_loop_arm_timer(int64_t deadline);
+
+#endif				// __EVENT_LOOP_H
@@ -0,0 +1,230 @@
+#define __FLUSHER_C
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "utils.h"
+#include "event_loop.h"
+#include "flusher.h"
+
+// Guards everything below and the flush fields of every handle
+static pthread_mutex_t flusher_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flusher_cond;	/* Work for the flusher thread */
+static pthread_cond_t synced_cond;	/* A batch has been synced */
+
+static pthread_t flusher_thread;
+static bool flusher_running = false;
+static bool flusher_stopping = false;
+
+static int64_t flush_interval;
+static uint64_t flush_max_bytes;
+
+// Handles with unsynced writes, most recent first
+static handle_t *dirty_handles = NULL;
+static uint64_t dirty_bytes = 0;
+static int64_t dirty_since;	/* Time of the oldest unsynced write */
+
+static int sync_fd(int fd)
+{
+#ifdef HAVE_FDATASYNC
+	return fdatasync(fd);
+#else
+	return fsync(fd);
+#endif
+}
+
+// Must be called with flusher_lock held.
+static void unlink_dirty(handle_t * handle)
+{
+	if (handle->dirty_prev)
+		handle->dirty_prev->dirty_next = handle->dirty_next;
+	else
+		dirty_handles = handle->dirty_next;
+	if (handle->dirty_next)
+		handle->dirty_next->dirty_prev = handle->dirty_prev;
+	handle->dirty = false;
+}
+
+// Must be called with flusher_lock held.
+static int take_error(handle_t * handle)
+{
+	int err = handle->flush_error;
+
+	handle->flush_error = 0;
+	return err ? -err : 0;
+}
+
+static void sync_batch(void)
+{
+	static handle_t **batch = NULL;
+	static size_t batch_size = 0;
+	handle_t *handle;
+	size_t i, count = 0;
+
+	// Taken off the list first: writes landing while we sync make the
+	// handle dirty again for the next batch.
+	for (handle = dirty_handles; handle; handle = handle->dirty_next) {
+		if (count == batch_size) {
+			batch_size = batch_size ? 2 * batch_size : 64;
+			batch = my_realloc(batch, batch_size * sizeof(*batch));
+		}
+		batch[count++] = handle;
+		handle->dirty = false;
+		handle->syncing = true;
+	}
+	dirty_handles = NULL;
+	dirty_bytes = 0;
+	pthread_mutex_unlock(&flusher_lock);
+
+	for (i = 0; i < count; i++)
+		batch[i]->sync_result = sync_fd(batch[i]->fd) == -1 ? errno : 0;
+
+	pthread_mutex_lock(&flusher_lock);
+	for (i = 0; i < count; i++) {
+		if (batch[i]->sync_result && !batch[i]->flush_error)
+			batch[i]->flush_error = batch[i]->sync_result;
+		batch[i]->syncing = false;
+	}
+	pthread_cond_broadcast(&synced_cond);
+}
+
+static void *flusher_thread_main(void *arg)
+{
+	struct timespec deadline;
+	int64_t due;
+
+	(void)arg;
+	pthread_mutex_lock(&flusher_lock);
+	for (;;) {
+		if (!dirty_handles) {
+			if (flusher_stopping)
+				break;
+			pthread_cond_wait(&flusher_cond, &flusher_lock);
+			continue;
+		}
+		due = dirty_since + flush_interval;
+		if (!flusher_stopping && dirty_bytes < flush_max_bytes &&
+		    event_loop_now() < due) {
+			deadline.tv_sec = due / 1000000;
+			deadline.tv_nsec = due % 1000000 * 1000;
+			pthread_cond_timedwait(&flusher_cond, &flusher_lock,
+					       &deadline);
+			continue;
+		}
+		sync_batch();
+	}
+	pthread_mutex_unlock(&flusher_lock);
+
+	return NULL;
+}
+
+int flusher_start(int64_t interval, uint64_t max_bytes)
+{
+	pthread_condattr_t attr;
+	int err;
+
+	flush_interval = interval;
+	flush_max_bytes = max_bytes;
+
+	// Deadlines are on event_loop_now()'s clock
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&flusher_cond, &attr);
+	pthread_condattr_destroy(&attr);
+	pthread_cond_init(&synced_cond, NULL);
+
+	if (!interval)
+		return 0;
+	if ((err = pthread_create(&flusher_thread, NULL, flusher_thread_main,
+				  NULL)) != 0) {
+		fprintf(stderr, "Failed to start flusher thread (%s)\n",
+			strerror(err));
+		return -1;
+	}
+	flusher_running = true;
+	return 0;
+}
+
+void flusher_stop(void)
+{
+	if (!flusher_running)
+		return;
+
+	pthread_mutex_lock(&flusher_lock);
+	flusher_stopping = true;
+	pthread_cond_signal(&flusher_cond);
+	pthread_mutex_unlock(&flusher_lock);
+
+	pthread_join(flusher_thread, NULL);
+	flusher_running = false;
+}
+
+int flusher_wrote(handle_t * handle, size_t size)
+{
+	int err;
+
+	if (!flush_interval)
+		return sync_fd(handle->fd) == -1 ? -errno : 0;
+
+	pthread_mutex_lock(&flusher_lock);
+	err = take_error(handle);
+	if (!handle->dirty) {
+		// Arms the flusher thread's deadline
+		if (!dirty_handles) {
+			dirty_since = event_loop_now();
+			pthread_cond_signal(&flusher_cond);
+		}
+		handle->dirty = true;
+		handle->dirty_prev = NULL;
+		handle->dirty_next = dirty_handles;
+		if (dirty_handles)
+			dirty_handles->dirty_prev = handle;
+		dirty_handles = handle;
+	}
+	dirty_bytes += size;
+	if (dirty_bytes >= flush_max_bytes)
+		pthread_cond_signal(&flusher_cond);
+	pthread_mutex_unlock(&flusher_lock);
+
+	return err;
+}
+
+// Takes the handle off the dirty list once any sync of it is over. Returns
+// whether it was dirty and sets *err to its pending error.
+static bool forget(handle_t * handle, int *err)
+{
+	bool dirty;
+
+	pthread_mutex_lock(&flusher_lock);
+	while (handle->syncing)
+		pthread_cond_wait(&synced_cond, &flusher_lock);
+	if ((dirty = handle->dirty))
+		unlink_dirty(handle);
+	*err = take_error(handle);
+	pthread_mutex_unlock(&flusher_lock);
+
+	return dirty;
+}
+
+int flusher_flush(handle_t * handle)
+{
+	int err;
+
+	if (forget(handle, &err) && sync_fd(handle->fd) == -1 && !err)
+		err = -errno;
+	return err;
+}
+
+int flusher_forget(handle_t * handle)
+{
+	int err;
+
+	forget(handle, &err);
+	return err;
+}
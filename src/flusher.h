@@ -0,0 +1,37 @@
+#ifndef __FLUSHER_H
+#define __FLUSHER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "handle_set.h"
+
+// Makes writes durable for -o flushwrites by group commit: handles written
+// to are synced together by a background thread once the interval has
+// passed since the first unsynced write or once enough bytes are waiting.
+// A sync failure is reported by the handle's next write, flush or fsync.
+// With an interval of 0 every write is synced before it returns.
+
+#undef EXTERN
+#ifdef __FLUSHER_C
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+// interval is in microseconds. Must be called before any other thread is
+// started.
+EXTERN int flusher_start(int64_t interval, uint64_t max_bytes);
+// Syncs whatever is left and stops the background thread.
+EXTERN void flusher_stop(void);
+// Records a write of size bytes through handle. Returns a pending sync
+// error (-errno) or 0.
+EXTERN int flusher_wrote(handle_t * handle, size_t size);
+// Syncs the handle now if it has unsynced writes and forgets it. Returns
+// the pending sync error (-errno) or 0. Must be called before the handle
+// is closed.
+EXTERN int flusher_flush(handle_t * handle);
+// Same as flusher_flush() without the sync, for callers about to sync the
+// handle themselves.
+EXTERN int flusher_forget(handle_t * handle);
+
+#endif				// __FLUSHER_H
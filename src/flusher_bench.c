@@ -0,0 +1,64 @@
+// Write throughput of -o flushwrites for a flush interval, without FUSE:
+// pwrite()s a file in 128k chunks the way afuse_write() does and makes it
+// durable at the end as close() would.
+//
+//   make flusher_bench
+//   ./flusher_bench 0 FILE      # sync every write
+//   ./flusher_bench 100 FILE    # the default interval
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "event_loop.h"
+#include "flusher.h"
+
+#define CHUNK (128 << 10)
+
+int main(int argc, char **argv)
+{
+	static char buf[CHUNK];
+	handle_t handle;
+	int64_t start, elapsed;
+	long i, count = 2048;	/* 256 MiB */
+
+	if (argc < 3) {
+		fprintf(stderr, "Usage: %s INTERVAL_MS FILE [CHUNKS]\n",
+			argv[0]);
+		return 1;
+	}
+	if (argc > 3)
+		count = atol(argv[3]);
+
+	memset(&handle, 0, sizeof(handle));
+	if ((handle.fd = open(argv[2], O_WRONLY | O_CREAT | O_TRUNC,
+			      0644)) == -1) {
+		perror(argv[2]);
+		return 1;
+	}
+	memset(buf, 'x', sizeof(buf));
+	if (flusher_start((int64_t)atol(argv[1]) * 1000, 8 << 20) == -1)
+		return 1;
+
+	start = event_loop_now();
+	for (i = 0; i < count; i++)
+		if (pwrite(handle.fd, buf, CHUNK, (off_t)i * CHUNK) != CHUNK ||
+		    flusher_wrote(&handle, CHUNK)) {
+			perror("write");
+			return 1;
+		}
+	if (flusher_flush(&handle)) {
+		perror("flush");
+		return 1;
+	}
+	elapsed = event_loop_now() - start;
+	flusher_stop();
+	close(handle.fd);
+
+	printf("interval %s ms: %.0f MB/s\n", argv[1],
+	       (double)count * CHUNK / elapsed);
+	return 0;
+}
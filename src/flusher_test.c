@@ -0,0 +1,61 @@
+// Checks that -o flushwrites syncs a handle left open within the flush
+// interval. fdatasync() fails on a pipe, which makes the background sync
+// visible as the error the handle's next write reports.
+
+#include <config.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include "event_loop.h"
+#include "flusher.h"
+
+#define INTERVAL 50000		/* us */
+
+static int check_synced(handle_t * handle, const char *what)
+{
+	struct timespec wait = { 0, 2 * INTERVAL * 1000 };
+	int err;
+
+	if ((err = flusher_wrote(handle, 1))) {
+		fprintf(stderr, "%s: unexpected error %s\n", what,
+			strerror(-err));
+		return 1;
+	}
+	nanosleep(&wait, NULL);
+	if ((err = flusher_wrote(handle, 0)) != -EINVAL) {
+		fprintf(stderr, "%s: not synced within %d ms (got %s)\n", what,
+			2 * INTERVAL / 1000, err ? strerror(-err) : "no error");
+		return 1;
+	}
+	return 0;
+}
+
+int main(void)
+{
+	handle_t handle;
+	int fds[2], failed = 0;
+
+	if (pipe(fds) == -1) {
+		perror("pipe");
+		return 1;
+	}
+	memset(&handle, 0, sizeof(handle));
+	handle.fd = fds[1];
+
+	if (flusher_start(INTERVAL, 8 << 20) == -1)
+		return 1;
+	// A single small write, far below flush_bytes
+	failed |= check_synced(&handle, "first write");
+	// The dirty list emptied by the last batch, the deadline must be
+	// armed again
+	failed |= check_synced(&handle, "write after a batch");
+	flusher_flush(&handle);
+	flusher_stop();
+
+	close(fds[0]);
+	close(fds[1]);
+	return failed;
+}
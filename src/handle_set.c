@@ -0,0 +1,44 @@
+#define __HANDLE_SET_C
+
+#include <stdlib.h>
+#include "utils.h"
+#include "handle_set.h"
+
+void handle_set_init(handle_set_t * set)
+{
+	set->handles = NULL;
+	set->count = 0;
+	set->size = 0;
+}
+
+void handle_set_destroy(handle_set_t * set)
+{
+	free(set->handles);
+	handle_set_init(set);
+}
+
+void handle_set_add(handle_set_t * set, handle_t * handle)
+{
+	if (set->count == set->size) {
+		set->size = set->size ? set->size * 2 : 8;
+		set->handles = my_realloc(set->handles,
+					  set->size * sizeof(*set->handles));
+	}
+
+	handle->index = set->count;
+	set->handles[set->count++] = handle;
+}
+
+void handle_set_remove(handle_set_t * set, handle_t * handle)
+{
+	handle_t *last = set->handles[--set->count];
+
+	// Move the last handle into the hole
+	set->handles[handle->index] = last;
+	last->index = handle->index;
+}
+
+bool handle_set_empty(handle_set_t * set)
+{
+	return set->count == 0;
+}
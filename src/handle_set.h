@@ -0,0 +1,53 @@
+#ifndef __HANDLE_SET_H
+#define __HANDLE_SET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "dir_stream.h"
+
+// Open files and directories of a mount. Handles are kept in a dense
+// array and know their own position in it, so adding and removing one
+// never walks the set.
+
+struct _mount_list_t;
+
+// Stored in fuse_file_info::fh for files and directories in a mount.
+typedef struct _handle_t {
+	int fd;			// -1 for directories
+	dir_stream_t *dir;	// NULL for files
+	// Mount owning the handle, with a reference held, or NULL.
+	struct _mount_list_t *mount;
+	bool sync_io;		// opened with O_SYNC or O_DSYNC
+
+	// The following are guarded by the lock of the set's owner
+	size_t index;		// position in handle_set_t::handles
+
+	// The following are guarded by the flusher, see flusher.h
+	bool dirty;		// written to since the last sync
+	bool syncing;		// being synced by the flusher thread
+	int sync_result;	// errno of that sync, or 0
+	int flush_error;	// errno of a sync not yet reported, or 0
+	struct _handle_t *dirty_prev;
+	struct _handle_t *dirty_next;
+} handle_t;
+
+typedef struct _handle_set_t {
+	handle_t **handles;
+	size_t count;
+	size_t size;
+} handle_set_t;
+
+#undef EXTERN
+#ifdef __HANDLE_SET_C
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+EXTERN void handle_set_init(handle_set_t * set);
+EXTERN void handle_set_destroy(handle_set_t * set);
+EXTERN void handle_set_add(handle_set_t * set, handle_t * handle);
+EXTERN void handle_set_remove(handle_set_t * set, handle_t * handle);
+EXTERN bool handle_set_empty(handle_set_t * set);
+
+#endif				// __HANDLE_SET_H
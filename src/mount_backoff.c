@@ -0,0 +1,216 @@
+#define __MOUNT_BACKOFF_C
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "utils.h"
+#include "mount_backoff.h"
+
+typedef struct _failure_t {
+	struct _failure_t *next;
+	uint32_t hash;
+	unsigned int count;	/* Consecutive failures */
+	int64_t retry_at;
+	size_t len;
+	char name[];		/* Not NUL terminated */
+} failure_t;
+
+#define TABLE_MIN_SIZE 16
+
+static failure_t **table = NULL;
+static size_t table_size = 0;	/* Power of two */
+static size_t failure_count = 0;
+static size_t prune_count = TABLE_MIN_SIZE;	/* Sweep once this many */
+static int64_t base_delay = 0;
+static int64_t max_delay = 0;
+static pthread_mutex_t backoff_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void mount_backoff_init(int64_t delay, int64_t max)
+{
+	base_delay = delay;
+	max_delay = max > delay ? max : delay;
+	table_size = TABLE_MIN_SIZE;
+	table = my_malloc(table_size * sizeof(*table));
+	memset(table, 0, table_size * sizeof(*table));
+}
+
+static failure_t **find_failure(const char *name, size_t len, uint32_t hash)
+{
+	failure_t **failure = &table[hash & (table_size - 1)];
+
+	for (; *failure; failure = &(*failure)->next)
+		if ((*failure)->hash == hash && (*failure)->len == len &&
+		    !memcmp((*failure)->name, name, len))
+			break;
+	return failure;
+}
+
+// link points to the failure, in its bucket.
+static void remove_failure(failure_t ** link)
+{
+	failure_t *failure = *link;
+
+	*link = failure->next;
+	failure_count--;
+	free(failure);
+}
+
+// Forgotten once not tried for max_delay
+static bool expired(const failure_t * failure, int64_t now)
+{
+	return now - failure->retry_at >= max_delay;
+}
+
+static void resize(size_t size)
+{
+	failure_t **new_table, *failure, *next;
+	size_t i;
+
+	new_table = my_malloc(size * sizeof(*new_table));
+	memset(new_table, 0, size * sizeof(*new_table));
+	for (i = 0; i < table_size; i++)
+		for (failure = table[i]; failure; failure = next) {
+			next = failure->next;
+			failure->next = new_table[failure->hash & (size - 1)];
+			new_table[failure->hash & (size - 1)] = failure;
+		}
+
+	free(table);
+	table = new_table;
+	table_size = size;
+}
+
+// Names failing once and never tried again would otherwise pile up
+static void prune(int64_t now)
+{
+	failure_t **link;
+	size_t i;
+
+	for (i = 0; i < table_size; i++)
+		for (link = &table[i]; *link;)
+			if (expired(*link, now))
+				remove_failure(link);
+			else
+				link = &(*link)->next;
+	prune_count = failure_count * 2 > TABLE_MIN_SIZE ? failure_count * 2 :
+	    TABLE_MIN_SIZE;
+}
+
+bool mount_backoff_active(const char *name, size_t len, uint32_t hash,
+			  int64_t now)
+{
+	failure_t *failure;
+	bool active;
+
+	if (!base_delay)
+		return false;
+
+	pthread_mutex_lock(&backoff_lock);
+	failure = *find_failure(name, len, hash);
+	active = failure && now < failure->retry_at;
+	pthread_mutex_unlock(&backoff_lock);
+
+	return active;
+}
+
+void mount_backoff_failed(const char *name, size_t len, uint32_t hash,
+			  int64_t now)
+{
+	failure_t **link, *failure;
+	int64_t delay = base_delay;
+	unsigned int i;
+
+	if (!base_delay)
+		return;
+
+	pthread_mutex_lock(&backoff_lock);
+	link = find_failure(name, len, hash);
+	if ((failure = *link) && expired(failure, now)) {
+		remove_failure(link);
+		failure = NULL;
+	}
+	if (!failure) {
+		if (failure_count >= prune_count) {
+			prune(now);
+			link = find_failure(name, len, hash);
+		}
+		/* Keep the load factor at most 1 */
+		if (++failure_count > table_size) {
+			resize(table_size * 2);
+			link = find_failure(name, len, hash);
+		}
+		failure = my_malloc(sizeof(failure_t) + len);
+		failure->next = NULL;
+		failure->hash = hash;
+		failure->count = 0;
+		failure->len = len;
+		memcpy(failure->name, name, len);
+		*link = failure;
+	}
+	failure->count++;
+	for (i = 1; i < failure->count && delay < max_delay; i++)
+		delay *= 2;
+	failure->retry_at = now + (delay < max_delay ? delay : max_delay);
+	pthread_mutex_unlock(&backoff_lock);
+}
+
+void mount_backoff_succeeded(const char *name, size_t len, uint32_t hash)
+{
+	mount_backoff_reset(name, len, hash);
+}
+
+bool mount_backoff_reset(const char *name, size_t len, uint32_t hash)
+{
+	failure_t **link;
+	bool found;
+
+	if (!base_delay)
+		return false;
+
+	pthread_mutex_lock(&backoff_lock);
+	link = find_failure(name, len, hash);
+	if ((found = *link != NULL))
+		remove_failure(link);
+	pthread_mutex_unlock(&backoff_lock);
+
+	return found;
+}
+
+void mount_backoff_reset_all(void)
+{
+	size_t i;
+
+	if (!base_delay)
+		return;
+
+	pthread_mutex_lock(&backoff_lock);
+	for (i = 0; i < table_size; i++)
+		while (table[i])
+			remove_failure(&table[i]);
+	pthread_mutex_unlock(&backoff_lock);
+}
+
+void mount_backoff_print(FILE * stream, const char *indent, int64_t now)
+{
+	failure_t *failure;
+	size_t i;
+
+	if (!base_delay)
+		return;
+
+	pthread_mutex_lock(&backoff_lock);
+	for (i = 0; i < table_size; i++)
+		for (failure = table[i]; failure; failure = failure->next) {
+			if (expired(failure, now))
+				continue;
+			fprintf(stream, "%s%.*s: %u failure%s", indent,
+				(int)failure->len, failure->name,
+				failure->count, failure->count > 1 ? "s" : "");
+			if (now < failure->retry_at)
+				fprintf(stream, ", next try in %llds",
+					(long long)((failure->retry_at - now +
+						     999999) / 1000000));
+			fprintf(stream, "\n");
+		}
+	pthread_mutex_unlock(&backoff_lock);
+}
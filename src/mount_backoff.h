@@ -0,0 +1,40 @@
+#ifndef __MOUNT_BACKOFF_H
+#define __MOUNT_BACKOFF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Roots whose mount command failed, which aren't mounted again until a
+// delay has passed. The delay doubles with every consecutive failure, up to
+// a maximum, and a root is forgiven once it has not been tried for that
+// maximum delay. Root names are the len bytes at name, which need not be
+// NUL terminated, and hash is their str_hash(). Times are in microseconds.
+// Can be used from any thread.
+
+#undef EXTERN
+#ifdef __MOUNT_BACKOFF_C
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+// Must be called before any other function. A delay of 0 disables the
+// backoff.
+EXTERN void mount_backoff_init(int64_t delay, int64_t max_delay);
+// Returns true if the root must not be mounted yet.
+EXTERN bool mount_backoff_active(const char *name, size_t len, uint32_t hash,
+				 int64_t now);
+EXTERN void mount_backoff_failed(const char *name, size_t len, uint32_t hash,
+				 int64_t now);
+EXTERN void mount_backoff_succeeded(const char *name, size_t len,
+				    uint32_t hash);
+// Forgets the failures of the root, returns false if there were none.
+EXTERN bool mount_backoff_reset(const char *name, size_t len, uint32_t hash);
+EXTERN void mount_backoff_reset_all(void);
+// Prints every root with failures, one per line, each preceded by indent.
+EXTERN void mount_backoff_print(FILE * stream, const char *indent,
+				int64_t now);
+
+#endif				// __MOUNT_BACKOFF_H
@@ -0,0 +1,362 @@
+#define __MOUNT_FILTER_C
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fnmatch.h>
+#include <regex.h>
+#include <pthread.h>
+#include "utils.h"
+#include "mount_filter.h"
+
+typedef enum {
+	PATTERN_LITERAL,	// "foo"
+	PATTERN_PREFIX,		// "foo*"
+	PATTERN_SUFFIX,		// "*foo"
+	PATTERN_COMPLEX		// anything else
+} pattern_kind_t;
+
+typedef struct _trie_node_t {
+	struct _trie_node_t *child;	/* First child */
+	struct _trie_node_t *sibling;
+	char c;
+	bool terminal;		/* A pattern ends here */
+} trie_node_t;
+
+// Patterns, in the order they were added
+static char **patterns = NULL;
+static size_t pattern_count = 0;
+
+// Plain names, in an open addressing hash set
+static const char **literals = NULL;
+static uint32_t *literal_hashes = NULL;
+static size_t literal_size = 0;	/* Power of two, 0 if there are none */
+
+static trie_node_t prefix_trie;
+static trie_node_t suffix_trie;	/* Built from the reversed suffixes */
+
+// Every other glob, combined into a single regular expression, except for
+// those we can't translate which are left to fnmatch().
+static regex_t complex_regex;
+static bool have_complex_regex = false;
+static const char **fnmatch_patterns = NULL;
+static size_t fnmatch_count = 0;
+
+// Results for the globs above are remembered per name
+#define MEMO_SIZE 1024
+
+static struct {
+	char *name;
+	uint32_t hash;
+	bool match;
+} memo[MEMO_SIZE];
+static pthread_mutex_t memo_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool is_wildcard(char c)
+{
+	return c == '*' || c == '?' || c == '[' || c == '\\';
+}
+
+// Stores the literal part of a prefix/suffix pattern in start/len.
+static pattern_kind_t classify(const char *glob, const char **start,
+			       size_t *len)
+{
+	size_t n = strlen(glob), begin = 0, end = n, i;
+
+	if (end > 0 && glob[end - 1] == '*')
+		while (end > 0 && glob[end - 1] == '*')
+			end--;
+	else
+		while (begin < n && glob[begin] == '*')
+			begin++;
+
+	for (i = begin; i < end; i++)
+		if (is_wildcard(glob[i]))
+			return PATTERN_COMPLEX;
+
+	*start = glob + begin;
+	*len = end - begin;
+	if (end < n)
+		return PATTERN_PREFIX;
+	if (begin > 0)
+		return PATTERN_SUFFIX;
+	return PATTERN_LITERAL;
+}
+
+static void trie_insert(trie_node_t * node, const char *str, size_t len,
+			bool reverse)
+{
+	trie_node_t *child;
+	size_t i;
+	char c;
+
+	for (i = 0; i < len; i++) {
+		c = reverse ? str[len - 1 - i] : str[i];
+		for (child = node->child; child && child->c != c;
+		     child = child->sibling) ;
+		if (!child) {
+			child = my_malloc(sizeof(trie_node_t));
+			child->c = c;
+			child->terminal = false;
+			child->child = NULL;
+			child->sibling = node->child;
+			node->child = child;
+		}
+		node = child;
+	}
+	node->terminal = true;
+}
+
+// Returns true if a pattern in the trie is a prefix (or, reversed, a
+// suffix) of str.
+static bool trie_match(const trie_node_t * node, const char *str, size_t len,
+		       bool reverse)
+{
+	size_t i;
+	char c;
+
+	for (i = 0;; i++) {
+		if (node->terminal)
+			return true;
+		if (i == len)
+			return false;
+		c = reverse ? str[len - 1 - i] : str[i];
+		for (node = node->child; node && node->c != c;
+		     node = node->sibling) ;
+		if (!node)
+			return false;
+	}
+}
+
+static bool literal_match(const char *name, size_t len, uint32_t hash)
+{
+	size_t i;
+
+	if (!literal_size)
+		return false;
+	for (i = hash & (literal_size - 1); literals[i];
+	     i = (i + 1) & (literal_size - 1))
+		if (literal_hashes[i] == hash &&
+		    !strncmp(literals[i], name, len) && !literals[i][len])
+			return true;
+	return false;
+}
+
+static char *regex_literal(char *p, char c)
+{
+	if (strchr(".[]{}()\\*+?^$|", c))
+		*p++ = '\\';
+	*p++ = c;
+	return p;
+}
+
+// Writes an anchored extended regular expression equivalent to glob at p,
+// which must have room for 2 * strlen(glob) + 4 characters, and returns
+// the end of it. Returns NULL for the globs it does not handle (escapes
+// and classes within brackets, trailing backslashes).
+static char *glob_to_regex(const char *glob, char *p)
+{
+	const char *end;
+
+	*p++ = '(';
+	*p++ = '^';
+	for (; *glob; glob++)
+		switch (*glob) {
+		case '*':
+			*p++ = '.';
+			*p++ = '*';
+			break;
+		case '?':
+			*p++ = '.';
+			break;
+		case '\\':
+			if (!*++glob)
+				return NULL;
+			p = regex_literal(p, *glob);
+			break;
+		case '[':
+			end = glob + 1;
+			if (*end == '!' || *end == '^')
+				end++;
+			if (*end == ']')
+				end++;
+			while (*end && *end != ']') {
+				if (*end == '\\' || (*end == '[' &&
+						     strchr(":.=", end[1])))
+					return NULL;
+				end++;
+			}
+			if (!*end) {
+				/* fnmatch() takes an unterminated '[' literally */
+				p = regex_literal(p, *glob);
+				break;
+			}
+			*p++ = *glob++;
+			if (*glob == '!' || *glob == '^') {
+				*p++ = '^';
+				glob++;
+			}
+			while (glob < end)
+				*p++ = *glob++;
+			*p++ = ']';
+			break;
+		default:
+			p = regex_literal(p, *glob);
+		}
+	*p++ = '$';
+	*p++ = ')';
+	return p;
+}
+
+void mount_filter_add(const char *glob)
+{
+	// Grow by doubling
+	if (!(pattern_count & (pattern_count - 1)))
+		patterns = my_realloc(patterns, (pattern_count ? 2 * pattern_count
+						 : 1) * sizeof(*patterns));
+	patterns[pattern_count++] = my_strdup(glob);
+}
+
+void mount_filter_compile(void)
+{
+	pattern_kind_t *kinds;
+	const char *start;
+	char *regex, *p, *end;
+	size_t i, len, literal_count = 0, regex_size = 1;
+	uint32_t hash;
+	int err;
+
+	kinds = my_malloc(pattern_count * sizeof(*kinds) + 1);
+	for (i = 0; i < pattern_count; i++) {
+		kinds[i] = classify(patterns[i], &start, &len);
+		if (kinds[i] == PATTERN_LITERAL)
+			literal_count++;
+		else if (kinds[i] == PATTERN_COMPLEX)
+			regex_size += 2 * strlen(patterns[i]) + 5;
+	}
+
+	if (literal_count) {
+		/* Keep the load factor at most 1/2 */
+		for (literal_size = 2; literal_size < 2 * literal_count;)
+			literal_size *= 2;
+		literals = my_malloc(literal_size * sizeof(*literals));
+		literal_hashes = my_malloc(literal_size *
+					   sizeof(*literal_hashes));
+		memset(literals, 0, literal_size * sizeof(*literals));
+	}
+
+	regex = p = my_malloc(regex_size);
+	fnmatch_patterns = my_malloc(pattern_count * sizeof(char *) + 1);
+	for (i = 0; i < pattern_count; i++)
+		switch (kinds[i]) {
+		case PATTERN_LITERAL:
+			hash = str_hash(patterns[i]);
+			for (len = hash & (literal_size - 1); literals[len];
+			     len = (len + 1) & (literal_size - 1)) ;
+			literals[len] = patterns[i];
+			literal_hashes[len] = hash;
+			break;
+		case PATTERN_PREFIX:
+			classify(patterns[i], &start, &len);
+			trie_insert(&prefix_trie, start, len, false);
+			break;
+		case PATTERN_SUFFIX:
+			classify(patterns[i], &start, &len);
+			trie_insert(&suffix_trie, start, len, true);
+			break;
+		case PATTERN_COMPLEX:
+			if (p != regex)
+				*p++ = '|';
+			if ((end = glob_to_regex(patterns[i], p)))
+				p = end;
+			else {
+				if (p != regex)
+					p--;
+				fnmatch_patterns[fnmatch_count++] =
+				    patterns[i];
+			}
+			break;
+		}
+	*p = '\0';
+
+	if (p != regex) {
+		if ((err = regcomp(&complex_regex, regex,
+				   REG_EXTENDED | REG_NOSUB)) == 0)
+			have_complex_regex = true;
+		else {
+			/* Shouldn't happen, but fnmatch() still works */
+			fprintf(stderr, "Failed to compile mount filters, "
+				"falling back to fnmatch()\n");
+			/* Add those glob_to_regex() translated */
+			for (i = 0; i < pattern_count; i++)
+				if (kinds[i] == PATTERN_COMPLEX &&
+				    glob_to_regex(patterns[i], regex))
+					fnmatch_patterns[fnmatch_count++] =
+					    patterns[i];
+		}
+	}
+
+	free(regex);
+	free(kinds);
+}
+
+static bool complex_match(const char *name)
+{
+	size_t i;
+
+	if (have_complex_regex &&
+	    regexec(&complex_regex, name, 0, NULL, 0) == 0)
+		return true;
+	for (i = 0; i < fnmatch_count; i++)
+		if (!fnmatch(fnmatch_patterns[i], name, 0))
+			return true;
+	return false;
+}
+
+bool mount_filter_match(const char *name, size_t len, uint32_t hash)
+{
+	size_t slot = hash & (MEMO_SIZE - 1);
+	char buf[256], *copy;
+	bool match;
+
+	if (literal_match(name, len, hash) ||
+	    trie_match(&prefix_trie, name, len, false) ||
+	    trie_match(&suffix_trie, name, len, true))
+		return true;
+	if (!have_complex_regex && !fnmatch_count)
+		return false;
+
+	pthread_mutex_lock(&memo_lock);
+	if (memo[slot].name && memo[slot].hash == hash &&
+	    !strncmp(memo[slot].name, name, len) && !memo[slot].name[len]) {
+		match = memo[slot].match;
+		pthread_mutex_unlock(&memo_lock);
+		return match;
+	}
+	pthread_mutex_unlock(&memo_lock);
+
+	/* regexec() and fnmatch() want a string */
+	copy = len < sizeof(buf) ? buf : my_malloc(len + 1);
+	memcpy(copy, name, len);
+	copy[len] = '\0';
+	match = complex_match(copy);
+
+	pthread_mutex_lock(&memo_lock);
+	free(memo[slot].name);
+	memo[slot].name = copy == buf ? my_strdup(copy) : copy;
+	memo[slot].hash = hash;
+	memo[slot].match = match;
+	pthread_mutex_unlock(&memo_lock);
+
+	return match;
+}
+
+void mount_filter_print(FILE * stream, const char *indent)
+{
+	size_t i;
+
+	for (i = 0; i < pattern_count; i++)
+		fprintf(stream, "%s%s\n", indent, patterns[i]);
+}
@@ -0,0 +1,31 @@
+#ifndef __MOUNT_FILTER_H
+#define __MOUNT_FILTER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Set of shell wildcard patterns (globs) root names are checked against.
+// Patterns are compiled into a combined matcher by mount_filter_compile():
+// plain names go into a hash set, "foo*" and "*bar" into prefix and suffix
+// tries, and only the remaining globs into one regular expression.
+
+#undef EXTERN
+#ifdef __MOUNT_FILTER_C
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+EXTERN void mount_filter_add(const char *glob);
+// Must be called once every pattern is added, before any lookup.
+EXTERN void mount_filter_compile(void);
+// Returns true if the len bytes at name, which need not be NUL terminated,
+// match a pattern as fnmatch(pattern, name, 0) would. hash must be their
+// str_hash(). Can be called from any thread.
+EXTERN bool mount_filter_match(const char *name, size_t len, uint32_t hash);
+// Prints every pattern, one per line, each preceded by indent.
+EXTERN void mount_filter_print(FILE * stream, const char *indent);
+
+#endif				// __MOUNT_FILTER_H
@@ -0,0 +1,167 @@
+#define __NOTIFIER_C
+
+#include <config.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include "utils.h"
+#include "notifier.h"
+
+#if FUSE_VERSION >= 28
+
+typedef struct _notification_t {
+	struct _notification_t *next;
+	char root_name[];
+} notification_t;
+
+// Guards everything below
+static pthread_mutex_t notifier_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t notifier_cond = PTHREAD_COND_INITIALIZER;
+
+static pthread_t notifier_thread;
+static bool notifier_running = false;
+static bool notifier_stopping = false;
+static struct fuse_chan *notifier_chan;
+
+// Oldest first
+static notification_t *queue_head = NULL;
+static notification_t **queue_tail = &queue_head;
+
+static void notify(notification_t * notification)
+{
+	const char *name = notification->root_name;
+	int err;
+
+	// -ENOENT only means the kernel had nothing cached
+	err = fuse_lowlevel_notify_inval_entry(notifier_chan, FUSE_ROOT_ID,
+					       name, strlen(name));
+	if (err && err != -ENOENT)
+		fprintf(stderr, "Failed to invalidate kernel entry: %s (%s)\n",
+			name, strerror(-err));
+	err = fuse_lowlevel_notify_inval_inode(notifier_chan, FUSE_ROOT_ID,
+					       0, 0);
+	if (err && err != -ENOENT)
+		fprintf(stderr, "Failed to invalidate kernel inode: / (%s)\n",
+			strerror(-err));
+}
+
+static void *notifier_thread_main(void *arg)
+{
+	notification_t *notification;
+
+	(void)arg;
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	for (;;) {
+		pthread_mutex_lock(&notifier_lock);
+		while (!queue_head && !notifier_stopping)
+			pthread_cond_wait(&notifier_cond, &notifier_lock);
+		if (notifier_stopping) {
+			pthread_mutex_unlock(&notifier_lock);
+			break;
+		}
+		notification = queue_head;
+		if (!(queue_head = notification->next))
+			queue_tail = &queue_head;
+		pthread_mutex_unlock(&notifier_lock);
+
+		// The kernel may never let go of the afuse root's lock once
+		// the request threads are gone, so notifier_stop() cancels
+		// us, which is only allowed while no lock is held.
+		pthread_cleanup_push(free, notification);
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		notify(notification);
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+		pthread_cleanup_pop(1);
+	}
+
+	return NULL;
+}
+
+int notifier_start(struct fuse_chan *ch)
+{
+	sigset_t set, oldset;
+	int err;
+
+	notifier_chan = ch;
+
+	// Signals are left to the event thread
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, &oldset);
+	err = pthread_create(&notifier_thread, NULL, notifier_thread_main,
+			     NULL);
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+	if (err) {
+		fprintf(stderr, "Failed to start notifier thread (%s)\n",
+			strerror(err));
+		return -1;
+	}
+	notifier_running = true;
+	return 0;
+}
+
+void notifier_stop(void)
+{
+	notification_t *notification;
+
+	if (!notifier_running)
+		return;
+
+	pthread_mutex_lock(&notifier_lock);
+	notifier_running = false;
+	notifier_stopping = true;
+	pthread_cond_signal(&notifier_cond);
+	pthread_mutex_unlock(&notifier_lock);
+	pthread_cancel(notifier_thread);
+	pthread_join(notifier_thread, NULL);
+
+	while ((notification = queue_head)) {
+		queue_head = notification->next;
+		free(notification);
+	}
+	queue_tail = &queue_head;
+}
+
+void notifier_forget_root(const char *root_name)
+{
+	notification_t *notification;
+	size_t len = strlen(root_name);
+
+	notification = my_malloc(sizeof(notification_t) + len + 1);
+	notification->next = NULL;
+	memcpy(notification->root_name, root_name, len + 1);
+
+	pthread_mutex_lock(&notifier_lock);
+	if (!notifier_running) {
+		pthread_mutex_unlock(&notifier_lock);
+		free(notification);
+		return;
+	}
+	*queue_tail = notification;
+	queue_tail = &notification->next;
+	pthread_cond_signal(&notifier_cond);
+	pthread_mutex_unlock(&notifier_lock);
+}
+
+#else				// FUSE_VERSION < 28
+
+int notifier_start(struct fuse_chan *ch)
+{
+	(void)ch;
+	return 0;
+}
+
+void notifier_stop(void)
+{
+}
+
+void notifier_forget_root(const char *root_name)
+{
+	(void)root_name;
+}
+
+#endif				// FUSE_VERSION >= 28
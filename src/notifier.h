@@ -0,0 +1,27 @@
+#ifndef __NOTIFIER_H
+#define __NOTIFIER_H
+
+#include <fuse_lowlevel.h>
+
+// Tells the kernel to forget what it caches about a root: its entry in the
+// afuse root, and so every dentry, inode and page cached below it, as well
+// as the attributes of the afuse root itself. Notifications are sent by a
+// background thread, since the kernel takes the afuse root's lock to
+// process them, which a request waiting for a mount may hold. Does nothing
+// before FUSE 2.8.
+
+#undef EXTERN
+#ifdef __NOTIFIER_C
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+// Must be called before any other thread is started.
+EXTERN int notifier_start(struct fuse_chan *ch);
+// Drops the notifications not sent yet and stops the background thread.
+EXTERN void notifier_stop(void);
+// Queues the invalidation of root_name. Can be called from any thread.
+EXTERN void notifier_forget_root(const char *root_name);
+
+#endif				// __NOTIFIER_H
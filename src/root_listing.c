@@ -0,0 +1,288 @@
+#define __ROOT_LISTING_C
+
+#include <config.h>
+
+#ifdef linux
+// For pipe2()
+#define _GNU_SOURCE
+#endif
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "utils.h"
+#include "event_loop.h"
+#include "root_listing.h"
+
+// A listing, as the NUL terminated entries one after the other
+typedef struct _listing_t {
+	char *entries;
+	size_t len;
+} listing_t;
+
+static const char *listing_command;
+static int64_t listing_ttl;
+
+// Guards everything below
+static pthread_mutex_t listing_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t refresh_cond = PTHREAD_COND_INITIALIZER;	/* Wanted */
+static pthread_cond_t refreshed_cond = PTHREAD_COND_INITIALIZER;
+
+static pthread_t refresher_thread;
+static bool refresher_running = false;
+static bool refresher_stopping = false;
+static pid_t refresher_pid = 0;	/* Of the command it is reading */
+static listing_t cached = { NULL, 0 };
+static bool have_cached = false;
+static int cached_error = 0;	/* Of the run cached is from */
+static int64_t fetched_at;
+static bool refresh_wanted = false;
+static bool refreshing = false;
+
+// Starts the command through the shell, as popen() would, but with
+// spawn_command()'s signal mask: listing scripts must stay killable.
+// Returns its stdout or NULL with errno set.
+static FILE *start_command(pid_t * pid)
+{
+	char *argv[] = { "/bin/sh", "-c", (char *)listing_command, NULL };
+	FILE *output;
+	int fds[2], err;
+
+	// Only the command's stdout is to be left open in the command. Mount
+	// commands are spawned concurrently, and a daemon inheriting the
+	// write end would keep us from ever seeing the end of the output.
+#ifdef HAVE_PIPE2
+	if (pipe2(fds, O_CLOEXEC) == -1)
+		return NULL;
+#else
+	if (pipe(fds) == -1)
+		return NULL;
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+#endif
+
+	err = spawn_command(argv, fds[1], pid);
+	close(fds[1]);
+	if (err) {
+		close(fds[0]);
+		errno = err;
+		return NULL;
+	}
+	if (!(output = fdopen(fds[0], "r"))) {
+		err = errno;
+		close(fds[0]);
+		kill(*pid, SIGTERM);
+		while (waitpid(*pid, NULL, 0) == -1 && errno == EINTR) ;
+		errno = err;
+	}
+	return output;
+}
+
+// Runs the command into listing. Returns 0, or -errno if it could not be
+// run, in which case listing is left empty. The refresher thread passes
+// refresher, which lets root_listing_stop() kill a command that hangs.
+static int run_command(listing_t * listing, bool refresher)
+{
+	FILE *browser;
+	size_t hsize = 0, size = 0;
+	ssize_t hlen;
+	char *dir_entry = NULL;
+	pid_t pid;
+	int status;
+
+	listing->entries = NULL;
+	listing->len = 0;
+
+	if ((browser = start_command(&pid)) == NULL) {
+		status = errno;
+		fprintf(stderr, "Failed to execute populate_root_command=%s (%s)\n",
+			listing_command, strerror(status));
+		return -status;
+	}
+	if (refresher) {
+		pthread_mutex_lock(&listing_lock);
+		if (refresher_stopping)
+			kill(pid, SIGTERM);
+		else
+			refresher_pid = pid;
+		pthread_mutex_unlock(&listing_lock);
+	}
+
+#ifdef HAVE_GETLINE
+	while ((hlen = getline(&dir_entry, &hsize, browser)) != -1)
+#else				// HAVE_FGETLN
+	while ((dir_entry = fgetln(browser, &hsize)) && (hlen = hsize))
+#endif
+	{
+		if (hlen >= 1 && dir_entry[hlen - 1] == '\n')
+			hlen--;
+		if (!hlen)
+			continue;
+
+		fprintf(stderr, "Got entry \"%.*s\"\n", (int)hlen, dir_entry);
+
+		if (listing->len + hlen + 1 > size) {
+			size = 2 * size > listing->len + hlen + 1 ?
+			    2 * size : listing->len + hlen + 1 + 256;
+			listing->entries = my_realloc(listing->entries, size);
+		}
+		memcpy(listing->entries + listing->len, dir_entry, hlen);
+		listing->entries[listing->len + hlen] = '\0';
+		listing->len += hlen + 1;
+	}
+
+#ifdef HAVE_GETLINE
+	free(dir_entry);
+#endif
+
+	fclose(browser);
+	// Not to be killed once reaped, the pid could be reused
+	if (refresher) {
+		pthread_mutex_lock(&listing_lock);
+		refresher_pid = 0;
+		pthread_mutex_unlock(&listing_lock);
+	}
+	while (waitpid(pid, &status, 0) == -1)
+		if (errno != EINTR) {
+			perror("populate_root_command: waitpid failed");
+			return 0;
+		}
+	if (status)
+		fprintf(stderr, "populate_root_command failed, status %d\n",
+			WIFEXITED(status) ? WEXITSTATUS(status) : status);
+
+	return 0;
+}
+
+static void for_each_entry(const listing_t * listing,
+			   root_listing_handler_t handler, void *arg)
+{
+	size_t i;
+
+	for (i = 0; i < listing->len; i += strlen(listing->entries + i) + 1)
+		handler(arg, listing->entries + i);
+}
+
+static void *refresher_thread_main(void *arg)
+{
+	listing_t listing;
+	int err;
+
+	(void)arg;
+	pthread_mutex_lock(&listing_lock);
+	for (;;) {
+		while (!refresh_wanted && !refresher_stopping)
+			pthread_cond_wait(&refresh_cond, &listing_lock);
+		if (refresher_stopping)
+			break;
+		refresh_wanted = false;
+		refreshing = true;
+		pthread_mutex_unlock(&listing_lock);
+
+		err = run_command(&listing, true);
+
+		pthread_mutex_lock(&listing_lock);
+		// Rather serve the last listing than none if the command
+		// can't be run at all
+		if (!err || !have_cached) {
+			free(cached.entries);
+			cached = listing;
+			cached_error = err;
+			have_cached = true;
+		}
+		fetched_at = event_loop_now();
+		refreshing = false;
+		pthread_cond_broadcast(&refreshed_cond);
+	}
+	pthread_mutex_unlock(&listing_lock);
+
+	return NULL;
+}
+
+int root_listing_start(const char *command, int64_t ttl)
+{
+	sigset_t set, oldset;
+	int err;
+
+	listing_command = command;
+	listing_ttl = ttl;
+	if (!command || !ttl)
+		return 0;
+
+	// Listed ahead of the first listing
+	refresh_wanted = true;
+	refresher_stopping = false;
+
+	// Signals are left to the event thread
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, &oldset);
+	err = pthread_create(&refresher_thread, NULL, refresher_thread_main,
+			     NULL);
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+	if (err) {
+		fprintf(stderr, "Failed to start refresher thread (%s)\n",
+			strerror(err));
+		return -1;
+	}
+	refresher_running = true;
+	return 0;
+}
+
+void root_listing_stop(void)
+{
+	if (!refresher_running)
+		return;
+
+	pthread_mutex_lock(&listing_lock);
+	refresher_stopping = true;
+	if (refresher_pid)
+		kill(refresher_pid, SIGTERM);
+	pthread_cond_signal(&refresh_cond);
+	pthread_mutex_unlock(&listing_lock);
+
+	pthread_join(refresher_thread, NULL);
+	refresher_running = false;
+
+	free(cached.entries);
+	cached.entries = NULL;
+	cached.len = 0;
+	have_cached = false;
+}
+
+int root_listing_for_each(root_listing_handler_t handler, void *arg)
+{
+	listing_t listing;
+	int err;
+
+	if (!listing_command)
+		return 0;
+
+	if (!listing_ttl) {
+		err = run_command(&listing, false);
+		for_each_entry(&listing, handler, arg);
+		free(listing.entries);
+		return err;
+	}
+
+	pthread_mutex_lock(&listing_lock);
+	if (!refresh_wanted && !refreshing &&
+	    (!have_cached || event_loop_now() - fetched_at >= listing_ttl)) {
+		refresh_wanted = true;
+		pthread_cond_signal(&refresh_cond);
+	}
+	while (!have_cached)
+		pthread_cond_wait(&refreshed_cond, &listing_lock);
+	for_each_entry(&cached, handler, arg);
+	err = cached_error;
+	pthread_mutex_unlock(&listing_lock);
+
+	return err;
+}
@@ -0,0 +1,33 @@
+#ifndef __ROOT_LISTING_H
+#define __ROOT_LISTING_H
+
+#include <stdint.h>
+
+// Entries of the afuse root listed by -o populate_root_command. With a TTL
+// the command's output is cached: listings are served from the cache at
+// once and a background thread reruns the command once the output is
+// older than the TTL, a single command at a time however many listings
+// find it stale. Only the first listing waits for the command. Without a
+// TTL the command is run for every listing.
+
+typedef void (*root_listing_handler_t) (void *arg, const char *name);
+
+#undef EXTERN
+#ifdef __ROOT_LISTING_C
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+// ttl is in microseconds. With a TTL, starts the background thread and the
+// first run of the command. Must be called before any other function.
+EXTERN int root_listing_start(const char *command, int64_t ttl);
+// Stops the background thread, killing the command if it is running. Must
+// not be called while listings may still be in progress.
+EXTERN void root_listing_stop(void);
+// Calls handler for every entry, which is not called concurrently by
+// other listings. Returns 0 or -errno if the command could not be run.
+// Can be called from any thread.
+EXTERN int root_listing_for_each(root_listing_handler_t handler, void *arg);
+
+#endif				// __ROOT_LISTING_H
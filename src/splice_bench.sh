@@ -0,0 +1,48 @@
+#!/bin/sh
+# Read and write throughput through afuse with file data spliced, the
+# default with FUSE 2.9 or later, and copied through afuse
+# (-o no_splice_read,no_splice_write). The roots are bind mounts of
+# directories in DIR, so this must be run as root. With DIR on a tmpfs the
+# disk stays out of the measurement. -o direct_io keeps FUSE's page cache
+# from serving the reads.
+#
+#   ./splice_bench.sh [-s MB] DIR
+
+set -e
+
+size=1024
+if [ "$1" = -s ]; then
+	size=$2
+	shift 2
+fi
+if [ $# -ne 1 ] || [ ! -d "$1" ]; then
+	echo "Usage: $0 [-s MB] DIR" >&2
+	exit 1
+fi
+
+dir=$(cd "$1" && pwd)
+afuse=${AFUSE:-$(dirname "$0")/afuse}
+mnt=$(mktemp -d)
+root=$(mktemp -d "$dir/afuse-bench.XXXXXX")
+trap 'fusermount -u "$mnt" 2>/dev/null || true; rmdir "$mnt" "$root"' EXIT
+
+# Prints the rate dd reports last
+rate() {
+	tail -n 1 | sed 's/.*, //'
+}
+
+run() {
+	label=$1
+	shift
+	"$afuse" -o mount_template="mount --bind \"$dir/%r\" %m" \
+		-o unmount_template="umount %m" -o direct_io "$@" "$mnt"
+	file=$mnt/${root##*/}/file
+	write=$(dd if=/dev/zero of="$file" bs=1M count="$size" 2>&1 | rate)
+	read=$(dd if="$file" of=/dev/null bs=1M 2>&1 | rate)
+	fusermount -u "$mnt"
+	rm -f "$root/file"
+	echo "$label: write $write, read $read"
+}
+
+run "splice" -o splice_read,splice_write
+run "copy" -o no_splice_read,no_splice_write
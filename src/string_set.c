@@ -0,0 +1,136 @@
+#define __STRING_SET_C
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "utils.h"
+#include "string_set.h"
+
+#define ARENA_CHUNK_SIZE 65536
+#define MIN_SLOTS 256
+
+typedef struct _arena_chunk_t {
+	struct _arena_chunk_t *next;
+	size_t used;
+	size_t size;
+	char data[];
+} arena_chunk_t;
+
+typedef struct _slot_t {
+	const char *str;	/* NULL if the slot is free */
+	uint32_t hash;
+} slot_t;
+
+struct _string_set_t {
+	arena_chunk_t *chunks;	/* Current chunk first */
+	slot_t *slots;
+	size_t slot_count;	/* Power of two */
+	size_t count;
+};
+
+string_set_t *string_set_new(void)
+{
+	string_set_t *set = my_malloc(sizeof(string_set_t));
+
+	set->chunks = NULL;
+	set->slot_count = MIN_SLOTS;
+	set->slots = my_malloc(set->slot_count * sizeof(slot_t));
+	memset(set->slots, 0, set->slot_count * sizeof(slot_t));
+	set->count = 0;
+
+	return set;
+}
+
+static char *arena_strdup(string_set_t * set, const char *str, size_t len)
+{
+	arena_chunk_t *chunk = set->chunks;
+	char *copy;
+
+	if (!chunk || chunk->size - chunk->used < len + 1) {
+		size_t size = len + 1 > ARENA_CHUNK_SIZE ?
+		    len + 1 : ARENA_CHUNK_SIZE;
+
+		chunk = my_malloc(sizeof(arena_chunk_t) + size);
+		chunk->used = 0;
+		chunk->size = size;
+		chunk->next = set->chunks;
+		set->chunks = chunk;
+	}
+
+	copy = chunk->data + chunk->used;
+	memcpy(copy, str, len + 1);
+	chunk->used += len + 1;
+
+	return copy;
+}
+
+static slot_t *find_slot(slot_t * slots, size_t slot_count, const char *str,
+			 uint32_t hash)
+{
+	size_t i;
+
+	for (i = hash & (slot_count - 1); slots[i].str;
+	     i = (i + 1) & (slot_count - 1))
+		if (slots[i].hash == hash && !strcmp(slots[i].str, str))
+			break;
+	return &slots[i];
+}
+
+static void grow(string_set_t * set)
+{
+	size_t slot_count = set->slot_count * 2, i;
+	slot_t *slots = my_malloc(slot_count * sizeof(slot_t));
+
+	memset(slots, 0, slot_count * sizeof(slot_t));
+	for (i = 0; i < set->slot_count; i++)
+		if (set->slots[i].str)
+			*find_slot(slots, slot_count, set->slots[i].str,
+				   set->slots[i].hash) = set->slots[i];
+
+	free(set->slots);
+	set->slots = slots;
+	set->slot_count = slot_count;
+}
+
+int string_set_insert(string_set_t * set, const char *str)
+{
+	uint32_t hash = STR_HASH_INIT;
+	size_t len;
+	slot_t *slot;
+
+	for (len = 0; str[len]; len++)
+		hash = STR_HASH_STEP(hash, str[len]);
+
+	slot = find_slot(set->slots, set->slot_count, str, hash);
+	if (slot->str)
+		return 1;
+
+	/* Keep the load factor at most 1/2 */
+	if (2 * (set->count + 1) > set->slot_count) {
+		grow(set);
+		slot = find_slot(set->slots, set->slot_count, str, hash);
+	}
+	slot->str = arena_strdup(set, str, len);
+	slot->hash = hash;
+	set->count++;
+
+	return 0;
+}
+
+int string_set_contains(const string_set_t * set, const char *str)
+{
+	return find_slot(set->slots, set->slot_count, str,
+			 str_hash(str))->str != NULL;
+}
+
+void string_set_free(string_set_t * set)
+{
+	arena_chunk_t *chunk;
+
+	while ((chunk = set->chunks)) {
+		set->chunks = chunk->next;
+		free(chunk);
+	}
+	free(set->slots);
+	free(set);
+}
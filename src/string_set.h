@@ -0,0 +1,24 @@
+#ifndef __STRING_SET_H
+#define __STRING_SET_H
+
+// Set of strings, used to remove duplicates from directory listings and to
+// look mount points up in the mount table.
+// The strings are copied into an arena owned by the set, so building a set
+// costs a handful of allocations and it is released in one go.
+
+typedef struct _string_set_t string_set_t;
+
+#undef EXTERN
+#ifdef __STRING_SET_C
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+EXTERN string_set_t *string_set_new(void);
+// Returns 1 if str was already in the set, 0 if it was added.
+EXTERN int string_set_insert(string_set_t * set, const char *str);
+EXTERN int string_set_contains(const string_set_t * set, const char *str);
+EXTERN void string_set_free(string_set_t * set);
+
+#endif				// __STRING_SET_H
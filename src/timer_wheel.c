@@ -0,0 +1,140 @@
+#define __TIMER_WHEEL_C
+
+#include "timer_wheel.h"
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+
+void timer_wheel_init(timer_wheel_t * wheel, int64_t now)
+{
+	int level, slot;
+
+	for (level = 0; level < TIMER_WHEEL_LEVELS; level++)
+		for (slot = 0; slot < TIMER_WHEEL_SLOTS; slot++)
+			wheel->slots[level][slot].next =
+			    wheel->slots[level][slot].prev =
+			    &wheel->slots[level][slot];
+	wheel->current = now;
+	wheel->count = 0;
+}
+
+static bool slot_empty(const timer_node_t * head)
+{
+	return head->next == head;
+}
+
+// Links node in the slot matching its expiry, relative to wheel->current.
+// Returns the level it went in.
+static int place(timer_wheel_t * wheel, timer_node_t * node)
+{
+	int64_t expires = node->expires, delta;
+	timer_node_t *head;
+	int level;
+
+	if (expires < wheel->current)
+		expires = wheel->current;
+	delta = expires - wheel->current;
+	for (level = 0; level < TIMER_WHEEL_LEVELS - 1; level++)
+		if (delta < (int64_t) 1 << (TIMER_WHEEL_BITS * (level + 1)))
+			break;
+	if (level == TIMER_WHEEL_LEVELS - 1 &&
+	    delta >= (int64_t) 1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+		/* Out of range, park it in the last slot we can reach */
+		expires = wheel->current +
+		    ((int64_t) 1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1;
+
+	head = &wheel->slots[level][(expires >> (TIMER_WHEEL_BITS * level)) &
+				    SLOT_MASK];
+	node->next = head;
+	node->prev = head->prev;
+	head->prev->next = node;
+	head->prev = node;
+
+	return level;
+}
+
+static void unlink_node(timer_node_t * node)
+{
+	node->prev->next = node->next;
+	node->next->prev = node->prev;
+	node->next = node->prev = NULL;
+}
+
+int64_t timer_wheel_add(timer_wheel_t * wheel, timer_node_t * node,
+			int64_t expires, int64_t now)
+{
+	// Nothing to expire, catch up with the time without turning the
+	// wheel.
+	if (!wheel->count && wheel->current < now)
+		wheel->current = now;
+
+	node->expires = expires;
+	wheel->count++;
+	if (place(wheel, node) == 0)
+		return expires > wheel->current ? expires : wheel->current;
+	/* It will be cascaded when level 0 wraps around */
+	return (wheel->current | SLOT_MASK) + 1;
+}
+
+void timer_wheel_remove(timer_wheel_t * wheel, timer_node_t * node)
+{
+	unlink_node(node);
+	wheel->count--;
+}
+
+// Moves the timers of the coarser levels due within the next turn of
+// level 0 down. Called whenever level 0 wraps around.
+static void cascade(timer_wheel_t * wheel)
+{
+	timer_node_t *head, *node;
+	int level, slot;
+
+	for (level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+		slot = (wheel->current >> (TIMER_WHEEL_BITS * level)) &
+		    SLOT_MASK;
+		head = &wheel->slots[level][slot];
+		while (!slot_empty(head)) {
+			node = head->next;
+			unlink_node(node);
+			place(wheel, node);
+		}
+		if (slot)
+			break;
+	}
+}
+
+timer_node_t *timer_wheel_expire(timer_wheel_t * wheel, int64_t now)
+{
+	timer_node_t *head, *node;
+
+	while (wheel->count) {
+		head = &wheel->slots[0][wheel->current & SLOT_MASK];
+		if (!slot_empty(head)) {
+			node = head->next;
+			timer_wheel_remove(wheel, node);
+			return node;
+		}
+		if (wheel->current >= now)
+			break;
+		if ((++wheel->current & SLOT_MASK) == 0)
+			cascade(wheel);
+	}
+	if (!wheel->count && wheel->current < now)
+		wheel->current = now;
+
+	return NULL;
+}
+
+int64_t timer_wheel_next(timer_wheel_t * wheel)
+{
+	int64_t tick;
+
+	if (!wheel->count)
+		return INT64_MAX;
+	for (tick = wheel->current;; tick++) {
+		if (!slot_empty(&wheel->slots[0][tick & SLOT_MASK]))
+			return tick;
+		if (tick > wheel->current && (tick & SLOT_MASK) == 0)
+			/* The coarser levels may have timers to cascade */
+			return tick;
+	}
+}
@@ -0,0 +1,64 @@
+#ifndef __TIMER_WHEEL_H
+#define __TIMER_WHEEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Hierarchical timer wheel. Times are in ticks, whose length is up to the
+// user. Adding and removing a timer are O(1); timers further than
+// TIMER_WHEEL_SLOTS ticks away sit in coarser levels and are cascaded down
+// as the wheel turns.
+
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4
+
+// Embedded in the structure being timed, see TIMER_WHEEL_ENTRY().
+typedef struct _timer_node_t {
+	struct _timer_node_t *next;	/* NULL while not scheduled */
+	struct _timer_node_t *prev;
+	int64_t expires;
+} timer_node_t;
+
+typedef struct _timer_wheel_t {
+	timer_node_t slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+	int64_t current;	/* Next tick to expire */
+	size_t count;
+} timer_wheel_t;
+
+#define TIMER_WHEEL_ENTRY(node, type, member) \
+	((type *)((char *)(node) - offsetof(type, member)))
+
+static inline void timer_node_init(timer_node_t * node)
+{
+	node->next = node->prev = NULL;
+}
+
+static inline bool timer_node_scheduled(const timer_node_t * node)
+{
+	return node->next != NULL;
+}
+
+#undef EXTERN
+#ifdef __TIMER_WHEEL_C
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+EXTERN void timer_wheel_init(timer_wheel_t * wheel, int64_t now);
+// Schedules node to expire at tick expires. now is the current tick.
+// Returns the tick by which timer_wheel_expire() must next be called for
+// node to expire on time.
+EXTERN int64_t timer_wheel_add(timer_wheel_t * wheel, timer_node_t * node,
+			       int64_t expires, int64_t now);
+EXTERN void timer_wheel_remove(timer_wheel_t * wheel, timer_node_t * node);
+// Returns, unscheduled, one node which expired by tick now, or NULL once
+// there are none left.
+EXTERN timer_node_t *timer_wheel_expire(timer_wheel_t * wheel, int64_t now);
+// Returns the tick by which timer_wheel_expire() must next be called, or
+// INT64_MAX if the wheel is empty.
+EXTERN int64_t timer_wheel_next(timer_wheel_t * wheel);
+
+#endif				// __TIMER_WHEEL_H
@@ -3,8 +3,13 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
 #include "utils.h"
 
+extern char **environ;
+
 void *my_malloc(size_t size)
 {
 	void *p;
@@ -20,6 +25,21 @@ void *my_malloc(size_t size)
 	return p;
 }
 
+void *my_realloc(void *ptr, size_t size)
+{
+	void *p;
+
+	p = realloc(ptr, size);
+
+	if (!p) {
+		fprintf(stderr, "Failed to allocate: %zu bytes of memory.\n",
+			size);
+		exit(1);
+	}
+
+	return p;
+}
+
 char *my_strdup(const char *str)
 {
 	char *new_str;
@@ -29,3 +49,42 @@ char *my_strdup(const char *str)
 
 	return new_str;
 }
+
+uint32_t str_hash(const char *str)
+{
+	uint32_t hash = STR_HASH_INIT;
+
+	while (*str)
+		hash = STR_HASH_STEP(hash, *str++);
+
+	return hash;
+}
+
+int spawn_command(char *const argv[], int stdout_fd, pid_t * pid)
+{
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	sigset_t sigs;
+	int err;
+
+	// Don't leak our signal mask (the event loop's signals are blocked) nor
+	// libfuse's SIGPIPE disposition to the command.
+	posix_spawnattr_init(&attr);
+	sigemptyset(&sigs);
+	posix_spawnattr_setsigmask(&attr, &sigs);
+	sigaddset(&sigs, SIGPIPE);
+	posix_spawnattr_setsigdefault(&attr, &sigs);
+	posix_spawnattr_setflags(&attr,
+				 POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+	posix_spawn_file_actions_init(&actions);
+	if (stdout_fd != -1)
+		posix_spawn_file_actions_adddup2(&actions, stdout_fd,
+						 STDOUT_FILENO);
+
+	err = posix_spawnp(pid, argv[0], &actions, &attr, argv, environ);
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+
+	return err;
+}
@@ -2,6 +2,12 @@
 #define __UTILS_H
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// FNV-1a, for callers hashing a string while they copy it
+#define STR_HASH_INIT 2166136261u
+#define STR_HASH_STEP(hash, c) (((hash) ^ (unsigned char)(c)) * 16777619u)
 
 #undef EXTERN
 #ifdef __UTILS_C
@@ -11,6 +17,12 @@
 #endif
 
 EXTERN void *my_malloc(size_t size);
+EXTERN void *my_realloc(void *ptr, size_t size);
 EXTERN char *my_strdup(const char *str);
+EXTERN uint32_t str_hash(const char *str);
+// Starts argv[0], searched in PATH, with an empty signal mask and SIGPIPE
+// at its default, whatever the calling thread blocks and libfuse ignores.
+// Its stdout is stdout_fd unless that is -1. Returns 0 or an errno value.
+EXTERN int spawn_command(char *const argv[], int stdout_fd, pid_t * pid);
 
 #endif				// __UTILS_H